@@ -0,0 +1,393 @@
+#include "Benchmark.h"
+#include "FrameProcessing.h"
+#include "SyntheticRoad.h"
+#include "FrameSource.h"
+
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <opencv2/core/hal/intrin.hpp>
+
+StageTiming TimeStage(const function<void()>& stage, int iterations, size_t pixels)
+{
+    iterations = max(iterations, 1);
+
+    // Warm up once so that the first allocation isn't counted
+    stage();
+
+    AllocationCounter& counter = AllocationCounter::Instance();
+    size_t matAllocations = counter.MatAllocations(), heapAllocations = counter.HeapAllocations();
+
+    TickMeter timer;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        timer.start();
+        stage();
+        timer.stop();
+    }
+
+    StageTiming timing;
+    timing.milliseconds = timer.getTimeMilli() / iterations;
+    timing.nanosecondsPerPixel = timing.milliseconds * 1e6 / max<size_t>(pixels, 1);
+    timing.matAllocations = (double)(counter.MatAllocations() - matAllocations) / iterations;
+    timing.heapAllocations = (double)(counter.HeapAllocations() - heapAllocations) / iterations;
+
+    return timing;
+}
+
+void BenchmarkLaneFilter(const Mat& frame, LaneFilterArgs args, int iterations)
+{
+    iterations = max(iterations, 1);
+
+    Mat splitChannels[3], colorMask, sobelMask;
+    LaneFilterData reference, fused;
+    size_t pixels = frame.total();
+
+    double splitTime = TimeStage([&]() { split(frame, splitChannels); }, iterations, pixels).milliseconds;
+    double colorTime = TimeStage([&]() { ColorMask(frame, colorMask, args); }, iterations, pixels).milliseconds;
+    double sobelTime = TimeStage([&]() { SobelMask(frame, sobelMask, args); }, iterations, pixels).milliseconds;
+    double laneFilterTime = TimeStage([&]() { LaneFilter(frame, reference, args); }, iterations, pixels).milliseconds;
+    double fusedTime = TimeStage([&]() { LaneFilterFused(frame, fused, args); }, iterations, pixels).milliseconds;
+
+    // The outputs should match apart from rounding ties at the thresholds
+    int colorMismatch = countNonZero(colorMask != fused.colorMask);
+    int sobelMismatch = countNonZero(sobelMask != fused.sobelMask);
+    int combinedMismatch = countNonZero(reference.combinedMask != fused.combinedMask);
+
+    cout << "Lane filter benchmark (" << frame.cols << "x" << frame.rows << ", " << iterations << " iterations, "
+        << (CV_SIMD ? "SIMD" : "scalar") << ")" << endl <<
+        "Split: " << splitTime << "ms" << endl <<
+        "Color Mask: " << colorTime << "ms" << endl <<
+        "Sobel Mask: " << sobelTime << "ms" << endl <<
+        "Lane Filter: " << laneFilterTime << "ms" << endl <<
+        "Lane Filter Fused: " << fusedTime << "ms (" << laneFilterTime / fusedTime << "x)" << endl <<
+        "Mismatched Pixels (color, sobel, combined): " << colorMismatch << ", " << sobelMismatch << ", " << combinedMismatch << endl;
+}
+
+bool BenchmarkStages(Size frameSize, int iterations)
+{
+    // Deterministic input, the same frame and calibration on every run
+    CalibrationData calibrationData = SyntheticCalibration(frameSize);
+    LaneGeometry geometry = CalculateLaneGeometry(frameSize);
+    const vector<Point2f>& sourcePoints = geometry.sourcePoints;
+    const vector<Point2f>& destinationPoints = geometry.destinationPoints;
+
+    Mat frame;
+    SyntheticRoadFrame(frame, frameSize, calibrationData, 0);
+
+    PartUndistortMapData undistortMapData;
+    CalculatePartUndistortMaps(undistortMapData, frameSize, calibrationData);
+
+    ViewTransformData viewTransform;
+    CalculateViewTransform(viewTransform, frameSize, calibrationData, sourcePoints, destinationPoints);
+
+    PipelineContext context;
+    context.Allocate(viewTransform, false);
+
+    LaneFilterArgs laneFilterArgs(220, 40, 205, Point2f(0.7f, 1.4f), 40, 20);
+    float metersPerPixelX = geometry.metersPerPixelX, metersPerPixelY = geometry.metersPerPixelY;
+
+    // Run the pipeline once so every stage gets the input it would see in ProcessFrame
+    Mat undistorted, skyView, skyViewMask, binary, output, colorMask, sobelMask, workFrame, nv12Frame;
+    vector<Point> lanePoints;
+    LaneFilterData laneFilterData;
+    CurveFitData curveData;
+    ProjectionData projectionData;
+
+    RemapFrame(frame, undistorted, calibrationData, undistortMapData);
+    LaneFilterFused(frame, laneFilterData, laneFilterArgs);
+    ViewTransformFrame(laneFilterData.combinedMask, skyViewMask, viewTransform);
+    int bandRows = frameSize.height / geometry.numWindows;
+    LaneMaskIndex maskIndex;
+    BinarizeLaneMask(skyViewMask, binary, frameSize, Point(0, 0), 150, Range(geometry.edgeLeft, geometry.edgeRight), bandRows, maskIndex);
+    CurveFit(binary, maskIndex, curveData, metersPerPixelX, metersPerPixelY, geometry.numWindows, geometry.windowWidth, geometry.minWindowPixels);
+    findNonZero(binary.colRange(0, binary.cols / 2), lanePoints);
+    ConvertBGRToNV12(frame(Rect(0, 0, frameSize.width & ~1, frameSize.height & ~1)), nv12Frame); // NV12 needs an even size
+    undistorted.copyTo(output);
+
+    // The lane tracker sizes the change of the curves on its second fitted frame, the warm up call of TimeStage alone would count that
+    for (int i = 0; i < 2; i++)
+    {
+        FrameRecord frameRecord;
+        frame.copyTo(workFrame);
+        ProcessFrame(workFrame, calibrationData, undistortMapData, viewTransform, context, frameRecord, false);
+    }
+
+    // The reference stages that ProcessFrame doesn't run allocate their temporaries, only the others have to reach a steady state
+    struct Stage
+    {
+        const char* name;
+        bool steadyState;
+        function<void()> run;
+    };
+
+    vector<Stage> stages = {
+        { "RemapFrame", true, [&]() { RemapFrame(frame, undistorted, calibrationData, undistortMapData); } },
+        { "SkyView", false, [&]() { SkyView(undistorted, skyView, sourcePoints, destinationPoints); } },
+        { "ViewTransformFrame", true, [&]() { ViewTransformFrame(frame, skyView, viewTransform); } },
+        { "ColorMask", false, [&]() { ColorMask(frame, colorMask, laneFilterArgs); } },
+        { "SobelMask", false, [&]() { SobelMask(frame, sobelMask, laneFilterArgs); } },
+        { "LaneFilter", false, [&]() { LaneFilter(frame, laneFilterData, laneFilterArgs); } },
+        { "LaneFilterFused", true, [&]() { LaneFilterFused(frame, laneFilterData, laneFilterArgs); } },
+        { "LaneFilterYuv", true, [&]() { LaneFilterYuv(nv12Frame, laneFilterData, laneFilterArgs); } },
+        { "ViewTransformFrame+LaneFilterFused", true, [&]() { ViewTransformFrame(frame, skyView, viewTransform); LaneFilterFused(skyView, laneFilterData, laneFilterArgs); } },
+        { "LaneFilterRemapped", true, [&]() { LaneFilterRemapped(frame, viewTransform.map1, viewTransform.map2, laneFilterData, laneFilterArgs); } },
+        { "BinarizeLaneMask", true, [&]() { BinarizeLaneMask(skyViewMask, binary, frameSize, Point(0, 0), 150, Range(geometry.edgeLeft, geometry.edgeRight), bandRows, maskIndex); } },
+        { "CurveFit", true, [&]() { CurveFit(binary, maskIndex, curveData, metersPerPixelX, metersPerPixelY, geometry.numWindows, geometry.windowWidth, geometry.minWindowPixels); } },
+        { "PolynomialFit", false, [&]() { PolynomialFit(lanePoints, 2); } },
+        // ProcessFrame hands the undistorted frame over as the output, so the lane is drawn in place without copying the frame
+        { "ProjectLane", true, [&]() { ProjectLane(output, output, viewTransform.inverseWarpMatrix, frameSize.width, curveData, projectionData); } },
+        // ProcessFrame writes its output over the frame, so the copy of the raw frame is part of this one
+        { "ProcessFrame", true, [&]() {
+            FrameRecord frameRecord;
+            frame.copyTo(workFrame);
+            ProcessFrame(workFrame, calibrationData, undistortMapData, viewTransform, context, frameRecord, false);
+        } },
+    };
+
+    bool allocationFree = true;
+
+    int defaultThreads = getNumThreads();
+    size_t pixels = frameSize.area();
+
+    printf("\n%dx%d, %d iterations, %d OpenCV threads, %s\n", frameSize.width, frameSize.height, iterations, defaultThreads, CV_SIMD ? "SIMD" : "scalar");
+    printf("%-20s %10s %8s %10s %8s %8s %10s %10s\n", "Stage", "1T ms", "ns/px", "NT ms", "ns/px", "Scaling", "Mat/call", "Heap/call");
+
+    for (const Stage& stage : stages)
+    {
+        setNumThreads(1);
+        StageTiming single = TimeStage(stage.run, iterations, pixels);
+
+        setNumThreads(defaultThreads);
+        StageTiming parallel = TimeStage(stage.run, iterations, pixels);
+
+        printf("%-20s %10.3f %8.2f %10.3f %8.2f %7.2fx %10.2f %10.2f\n", stage.name,
+            single.milliseconds, single.nanosecondsPerPixel, parallel.milliseconds, parallel.nanosecondsPerPixel,
+            single.milliseconds / max(parallel.milliseconds, 1e-9), single.matAllocations, single.heapAllocations);
+
+        if (stage.steadyState && (single.matAllocations > 0 || parallel.matAllocations > 0))
+        {
+            printf("%s allocates %.2f Mats per call on one thread and %.2f on all of them\n", stage.name, single.matAllocations, parallel.matAllocations);
+            allocationFree = false;
+        }
+    }
+
+    fflush(stdout);
+
+    return allocationFree;
+}
+
+void BenchmarkThreadScaling(Size frameSize, int iterations, int maxThreads)
+{
+    iterations = max(iterations, 1);
+    maxThreads = max(maxThreads, 1);
+
+    CalibrationData calibrationData = SyntheticCalibration(frameSize);
+    LaneGeometry geometry = CalculateLaneGeometry(frameSize);
+    const vector<Point2f>& sourcePoints = geometry.sourcePoints;
+    const vector<Point2f>& destinationPoints = geometry.destinationPoints;
+
+    Mat frame;
+    SyntheticRoadFrame(frame, frameSize, calibrationData, 0);
+
+    PartUndistortMapData undistortMapData;
+    CalculatePartUndistortMaps(undistortMapData, frameSize, calibrationData);
+
+    ViewTransformData viewTransform;
+    CalculateViewTransform(viewTransform, frameSize, calibrationData, sourcePoints, destinationPoints);
+
+    // Frame level parallelism only, so the OpenCV functions run single threaded inside each worker
+    int defaultThreads = getNumThreads();
+    setNumThreads(1);
+
+    printf("\n%dx%d ProcessFrame thread scaling, %d frames per thread\n", frameSize.width, frameSize.height, iterations);
+    printf("%-8s %10s %10s %10s\n", "Threads", "Frames/s", "Speedup", "Efficiency");
+
+    double singleThreadRate = 0;
+
+    for (int numThreads = 1; numThreads <= maxThreads; numThreads = numThreads < maxThreads ? min(numThreads * 2, maxThreads) : maxThreads + 1)
+    {
+        // The contexts are sized up front so that only the steady state is timed
+        vector<PipelineContext> contexts(numThreads);
+
+        for (PipelineContext& context : contexts)
+            context.Allocate(viewTransform, false);
+
+        vector<thread> workers;
+        auto start = chrono::steady_clock::now();
+
+        for (int i = 0; i < numThreads; i++)
+        {
+            workers.emplace_back([&, i]()
+            {
+                PipelineContext& context = contexts[i];
+                Mat workFrame;
+                FrameRecord frameRecord;
+
+                for (int j = 0; j < iterations; j++)
+                {
+                    frame.copyTo(workFrame);
+                    ProcessFrame(workFrame, calibrationData, undistortMapData, viewTransform, context, frameRecord, false);
+                }
+            });
+        }
+
+        for (thread& worker : workers)
+            worker.join();
+
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        double rate = numThreads * iterations / max(seconds, 1e-9);
+
+        if (numThreads == 1)
+            singleThreadRate = rate;
+
+        printf("%-8d %10.1f %9.2fx %9.0f%%\n", numThreads, rate, rate / singleThreadRate, 100.0 * rate / (singleThreadRate * numThreads));
+    }
+
+    setNumThreads(defaultThreads);
+    fflush(stdout);
+}
+
+// Pipeline configurations compared by the scoreboard, each speed oriented mode next to the full pipeline it trades accuracy against
+struct ScoreboardMode
+{
+    const char* name;
+    double processingScale;
+    bool filterInSkyView;
+    bool nv12; // Frames arrive as NV12, converted before the timing like a decoder would deliver them
+    bool alternateFrames; // Every other frame extrapolates the lanes, the scheduler's last level
+    bool renderOutput;
+};
+
+void BenchmarkScoreboard(const string videoPath, int maxFrames, bool calibrate)
+{
+    SyntheticTruth truth;
+    FrameSource video;
+
+    // Raw .nv12 videos have no header, their size comes from the ground truth
+    if (!LoadSyntheticTruth(videoPath, truth) || !video.Open(videoPath, FrameFormat::BGR, truth.frameSize))
+    {
+        printf("Could not open %s with its ground truth\n", videoPath.c_str());
+        return;
+    }
+
+    Size frameSize = video.FrameSize();
+    int frames = min(maxFrames > 0 ? maxFrames : INT_MAX, (int)truth.lanes.size());
+    LaneGeometry geometry = CalculateLaneGeometry(frameSize);
+    CalibrationData calibrationData = truth.calibrationData;
+
+    printf("\nScoreboard of %s, %dx%d, %d frames, %s lens, %d OpenCV threads\n", videoPath.c_str(), frameSize.width, frameSize.height, frames,
+        SyntheticLensName(truth.lens), getNumThreads());
+
+    if (calibrate)
+    {
+        CalibrationData recovered;
+        double error = SyntheticCalibrationRoundTrip(CreateSyntheticCamera(frameSize, calibrationData), recovered);
+
+        if (error < 0)
+            printf("Calibration found no chessboards, using the true calibration\n");
+        else
+        {
+            printf("Recovered calibration: focal length %.1f (true %.1f), k1 %.4f (true %.4f), undistortion error %.3fpx\n",
+                recovered.camMatrix.at<double>(0, 0), calibrationData.camMatrix.at<double>(0, 0),
+                recovered.distortion.at<double>(0), calibrationData.distortion.at<double>(0), error);
+
+            calibrationData = recovered;
+        }
+    }
+
+    PartUndistortMapData undistortMapData;
+    CalculatePartUndistortMaps(undistortMapData, frameSize, calibrationData);
+
+    bool evenSize = frameSize.width % 2 == 0 && frameSize.height % 2 == 0;
+
+    vector<ScoreboardMode> modes = {
+        { "Full", 1.0, false, false, false, true },
+        { "Headless", 1.0, false, false, false, false },
+        { "Sky view filter", 1.0, true, false, false, true },
+        { "NV12 input", 1.0, false, true, false, true },
+        { "Scale 0.75", 0.75, false, false, false, true },
+        { "Scale 0.5", 0.5, false, false, false, true },
+        { "Alternate frames", 1.0, false, false, true, true },
+    };
+
+    // Frames/s is the sequential throughput of one processing thread, the lane errors are sky view pixels at the video resolution
+    printf("%-18s %9s %9s %9s %11s %11s %13s %14s\n", "Mode", "Frames/s", "Mean ms", "p99 ms", "Lane err px", "Lane err cm", "Offset err cm", "Curv err 1/km");
+
+    for (const ScoreboardMode& mode : modes)
+    {
+        if (mode.nv12 && !evenSize)
+            continue;
+
+        ViewTransformData viewTransform;
+        CalculateProcessingViewTransform(viewTransform, frameSize, ProcessingSize(frameSize, mode.processingScale), mode.filterInSkyView, calibrationData);
+
+        PipelineContext context;
+        context.Allocate(viewTransform, mode.filterInSkyView);
+        context.renderOutput = mode.renderOutput;
+
+        LatencySketch latency;
+        double totalSeconds = 0, laneError = 0, positionError = 0, curvatureError = 0;
+        int scored = 0;
+        Mat frame, colorFrame, nv12Frame, workFrame;
+
+        video.Rewind();
+
+        for (int i = 0; i < frames && video.Read(frame); i++)
+        {
+            // Raw videos come in as NV12, everything else as BGR, each mode gets the layout it asks for
+            bool frameIsNV12 = GetFrameFormat(frame) == FrameFormat::NV12;
+
+            if (frameIsNV12 && !mode.nv12)
+                ConvertFrameToBGR(frame, colorFrame);
+            else if (!frameIsNV12 && mode.nv12)
+                ConvertBGRToNV12(frame, nv12Frame);
+
+            const Mat& input = frameIsNV12 == mode.nv12 ? frame : mode.nv12 ? nv12Frame : colorFrame;
+            input.copyTo(workFrame);
+            context.extrapolateLanes = mode.alternateFrames && i % 2 == 1;
+
+            FrameRecord frameRecord;
+            TickMeter timer;
+
+            timer.start();
+            ProcessFrame(workFrame, calibrationData, undistortMapData, viewTransform, context, frameRecord, false, mode.filterInSkyView);
+            timer.stop();
+
+            latency.Add(timer.getTimeSec());
+            totalSeconds += timer.getTimeSec();
+
+            // Lane positions at the top, the middle and the bottom of the sky view
+            const SyntheticLanes& lanes = truth.lanes[i];
+            double frameLaneError = 0;
+
+            for (double y : { 0.0, frameSize.height / 2.0, frameSize.height - 1.0 })
+            {
+                auto evaluate = [y](const float* K) { return (K[2] * y + K[1]) * y + K[0]; };
+
+                frameLaneError += abs(evaluate(frameRecord.leftK) - evaluate(lanes.leftPixelK.ptr<float>()));
+                frameLaneError += abs(evaluate(frameRecord.rightK) - evaluate(lanes.rightPixelK.ptr<float>()));
+            }
+
+            // Straight roads have an unbounded radius, so the curvature is compared instead
+            auto curvature = [](float radius) { return radius > 0 ? 1000.0 / radius : 0.0; };
+
+            laneError += frameLaneError / 6;
+            positionError += abs(frameRecord.vehiclePosition - lanes.vehiclePosition);
+            curvatureError += (abs(curvature(frameRecord.leftRadius) - curvature(lanes.leftRadius)) +
+                abs(curvature(frameRecord.rightRadius) - curvature(lanes.rightRadius))) / 2;
+            scored++;
+        }
+
+        scored = max(scored, 1);
+
+        printf("%-18s %9.1f %9.3f %9.3f %11.2f %11.1f %13.1f %14.3f\n", mode.name,
+            scored / max(totalSeconds, 1e-9), totalSeconds * 1000 / scored, latency.Percentile(99) * 1000,
+            laneError / scored, laneError / scored * geometry.metersPerPixelX * 100, positionError / scored * 100, curvatureError / scored);
+    }
+
+    fflush(stdout);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "LaneFilter.h"
+
+#include <functional>
+#include <string>
+#include <opencv2/core.hpp>
+
+using namespace std;
+using namespace cv;
+
+// Average cost of one call of a stage, measured after a warm up call
+// Allocations are only counted while the AllocationCounter is installed, heap allocations only with LANE_COUNT_HEAP_ALLOCATIONS
+struct StageTiming
+{
+    double milliseconds = 0;
+    double nanosecondsPerPixel = 0;
+    double matAllocations = 0, heapAllocations = 0;
+};
+
+StageTiming TimeStage(const function<void()>& stage, int iterations, size_t pixels);
+
+// Times each lane filter stage on the frame and compares LaneFilter against LaneFilterFused
+void BenchmarkLaneFilter(const Mat& frame, LaneFilterArgs args, int iterations);
+
+// Times every pipeline stage in isolation on a synthetic road frame, on one OpenCV thread and on all of them
+// Returns false if a stage that ProcessFrame runs on every frame allocated a Mat after its warm up call, needs the AllocationCounter installed
+bool BenchmarkStages(Size frameSize, int iterations);
+
+// Runs whole frames through ProcessFrame on 1 to maxThreads threads, each with its own PipelineContext like the -w processing threads
+void BenchmarkThreadScaling(Size frameSize, int iterations, int maxThreads);
+
+
+// Runs every frame of a synthetic road video through ProcessFrame in each pipeline mode and scores the results against the ground truth
+// Reports the throughput, the mean and p99 latency, and the lane, vehicle position and curvature errors of each mode
+// calibrate replaces the true calibration with the one Calibrate recovers from synthetic chessboards, like a real camera would be set up
+void BenchmarkScoreboard(const string videoPath, int maxFrames, bool calibrate);
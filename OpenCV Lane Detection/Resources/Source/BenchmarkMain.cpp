@@ -0,0 +1,139 @@
+#include "Benchmark.h"
+#include "PipelineContext.h"
+#include "SyntheticRoad.h"
+#include "Trace.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <opencv2/core/utils/logger.hpp>
+
+using namespace std;
+
+// Standalone benchmark of the pipeline stages on synthetic frames, built as its own executable next to the lane detection
+int main(int argc, char* argv[])
+{
+    cv::utils::logging::setLogLevel(cv::utils::logging::LOG_LEVEL_ERROR);
+
+    int iterations = 50;
+    int maxThreads = max(1, (int)thread::hardware_concurrency());
+    bool stages = true, scaling = true;
+    vector<Size> frameSizes;
+
+    // Synthetic road video with ground truth, written with --generate and scored with --scoreboard
+    string generatePath, scoreboardPath;
+    int videoFrames = 300;
+    SyntheticLens lens = SyntheticLens::Barrel;
+    bool calibrate = false;
+
+    // Chrome trace of every benchmarked stage, written when the benchmark finishes
+    string tracePath;
+
+    for (int i = 0; i < argc; i++)
+    {
+        string arg(argv[i]);
+
+        if (arg == "-i")
+            iterations = max(1, stoi(argv[++i]));
+        if (arg == "-t")
+            maxThreads = max(1, stoi(argv[++i]));
+        if (arg == "-r")
+        {
+            int width = 0, height = 0;
+
+            if (sscanf(argv[++i], "%dx%d", &width, &height) == 2 && width > 0 && height > 0)
+                frameSizes.push_back(Size(width, height));
+        }
+        if (arg == "--stages-only")
+            scaling = false;
+        if (arg == "--scaling-only")
+            stages = false;
+        if (arg == "--generate")
+            generatePath = argv[++i];
+        if (arg == "--scoreboard")
+            scoreboardPath = argv[++i];
+        if (arg == "-n")
+            videoFrames = max(1, stoi(argv[++i]));
+        if (arg == "--lens" && !ParseSyntheticLens(argv[++i], lens))
+            printf("Unknown lens %s, use none, barrel, pincushion or wide\n", argv[i]);
+        if (arg == "--calibrate")
+            calibrate = true;
+        if (arg == "--trace")
+            tracePath = argv[++i];
+    }
+
+    if (!tracePath.empty())
+    {
+#ifndef LANE_TRACE
+        printf("Built without LANE_TRACE, the trace will be empty\n");
+#endif
+        EnableTracing(true);
+    }
+
+    auto exportTrace = [&]()
+    {
+        if (!tracePath.empty() && !ExportTrace(tracePath))
+            printf("Could not write the trace %s\n", tracePath.c_str());
+    };
+
+    // The video runs are their own benchmark, the stage timings are skipped
+    if (!generatePath.empty() || !scoreboardPath.empty())
+    {
+        Size frameSize = frameSizes.empty() ? Size(1280, 720) : frameSizes[0];
+
+        // The scoreboard renders its video first if it doesn't exist yet
+        if (generatePath.empty() && !filesystem::exists(scoreboardPath + ".truth.yml"))
+            generatePath = scoreboardPath;
+
+        if (!generatePath.empty())
+        {
+            printf("Rendering %d frames of %dx%d road with a %s lens to %s\n", videoFrames, frameSize.width, frameSize.height, SyntheticLensName(lens), generatePath.c_str());
+
+            if (!WriteSyntheticRoadVideo(generatePath, frameSize, videoFrames, lens))
+            {
+                printf("Could not write %s\n", generatePath.c_str());
+                return 1;
+            }
+        }
+
+        if (!scoreboardPath.empty())
+            BenchmarkScoreboard(scoreboardPath, videoFrames, calibrate);
+
+        exportTrace();
+
+        return 0;
+    }
+
+    if (frameSizes.empty())
+        frameSizes = { Size(1280, 720), Size(1920, 1080), Size(3840, 2160) };
+
+    // Count the Mat allocations of every stage, the run fails if a per-frame stage still allocates after its warm up call
+    AllocationCounter::Instance().Install();
+    bool allocationFree = true;
+
+#ifndef LANE_COUNT_HEAP_ALLOCATIONS
+    printf("Built without LANE_COUNT_HEAP_ALLOCATIONS, heap allocations are not counted\n");
+#endif
+
+    for (Size frameSize : frameSizes)
+    {
+        if (stages && !BenchmarkStages(frameSize, iterations))
+            allocationFree = false;
+
+        if (scaling)
+            BenchmarkThreadScaling(frameSize, iterations, maxThreads);
+    }
+
+    AllocationCounter::Instance().Uninstall();
+
+    exportTrace();
+
+    if (!allocationFree)
+    {
+        printf("\nPer-frame stages allocated Mats in the steady state\n");
+        return 1;
+    }
+
+    return 0;
+}
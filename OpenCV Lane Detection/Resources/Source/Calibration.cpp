@@ -1,48 +1,288 @@
 #include "Calibration.h"
 
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <opencv2/imgcodecs.hpp>
+
+// Longest side of the copy the chessboard is searched in, the corners are refined on the full image afterwards
+// The corner cache is tagged with every detection parameter, so changing one of them detects the images again
+static const int DetectionSize = 640;
+static const int DetectionFlags = CALIB_CB_ADAPTIVE_THRESH | CALIB_CB_NORMALIZE_IMAGE | CALIB_CB_FAST_CHECK;
+static const int MinRefinementWindow = 11;
+static const TermCriteria RefinementCriteria(TermCriteria::EPS | TermCriteria::MAX_ITER, 30, 0.01);
+
+bool FindCalibrationCorners(const Mat& image, Size boardSize, vector<Point2f>& corners)
+{
+	corners.clear();
+
+	if (image.empty())
+		return false;
+
+	Mat gray;
+
+	if (image.channels() == 1)
+		gray = image;
+	else
+		cvtColor(image, gray, COLOR_BGR2GRAY);
+
+	double scale = min(1.0, (double)DetectionSize / max(gray.cols, gray.rows));
+	Mat small;
+
+	if (scale < 1.0)
+		resize(gray, small, Size(), scale, scale, INTER_AREA);
+	else
+		small = gray;
+
+	if (!findChessboardCorners(small, boardSize, corners, DetectionFlags))
+		return false;
+
+	// Scale back up, the search window (half size) covers the error of the downscaled detection
+	for (Point2f& corner : corners)
+		corner *= 1.0 / scale;
+
+	int window = max(MinRefinementWindow, (int)ceil(4.0 / scale));
+	cornerSubPix(gray, corners, Size(window, window), Size(-1, -1), RefinementCriteria);
+
+	return true;
+}
+
+// Get the calibration matrix and distortion coefficients from the chessboard corners
+static CalibrationData CalibrateFromCorners(const vector<vector<Point2f>>& imagePoints, Size imageSize, Size boardSize, float squareSize)
+{
+	CalibrationData calibrationData;
+
+	if (imagePoints.empty())
+		return calibrationData;
+
+	vector<Point3f> object;
+
+	for (int i = 0; i < boardSize.height; i++)
+		for (int j = 0; j < boardSize.width; j++)
+			object.push_back(Point3f(j * squareSize, i * squareSize, 0));
+
+	vector<vector<Point3f>> objectPoints(imagePoints.size(), object);
+	vector<Mat> rotationVecs, transformationVecs;
+
+	calibrateCamera(objectPoints, imagePoints, imageSize, calibrationData.camMatrix,
+		calibrationData.distortion, rotationVecs, transformationVecs);
+
+	return calibrationData;
+}
+
 CalibrationData Calibrate(const vector<Mat>& images, Size boardSize, float squareSize)
 {
 	if (images.empty())
 		return CalibrationData();
 
-	CalibrationData calibrationData;
-	vector<Point2f> corners;
-	vector<vector<Point3f>> objectPoints;
+	// Every image is searched on its own thread, the images are only read
+	vector<vector<Point2f>> corners(images.size());
+	vector<char> found(images.size(), 0);
+
+	parallel_for_(Range(0, (int)images.size()), [&](const Range& range)
+	{
+		for (int i = range.start; i < range.end; i++)
+			found[i] = FindCalibrationCorners(images[i], boardSize, corners[i]);
+	});
+
 	vector<vector<Point2f>> imagePoints;
-	vector<Mat> rotationVecs, transformationVecs;
 
-	for (Mat image : images)
+	for (size_t i = 0; i < images.size(); i++)
+		if (found[i])
+			imagePoints.push_back(std::move(corners[i]));
+
+	return CalibrateFromCorners(imagePoints, images[0].size(), boardSize, squareSize);
+}
+
+// Detection result of one calibration image, as stored in the corner cache
+struct CalibrationImage
+{
+	uint64_t hash = 0;
+	Size size;
+	bool found = false, valid = false;
+	vector<Point2f> corners;
+};
+
+// 64 bit FNV-1a of the file contents
+static uint64_t HashBytes(const vector<uchar>& bytes)
+{
+	uint64_t hash = 14695981039346656037ull;
+
+	for (uchar byte : bytes)
 	{
-		// For some reason, OpenCV doesn't want to convert the image to gray
-		// It instead converts to 16FC3
-		//Mat gray;
-		//image.convertTo(gray, COLOR_RGB2GRAY);
-		Mat duplicate;
-		image.copyTo(duplicate);
+		hash ^= byte;
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+static string HashKey(uint64_t hash)
+{
+	char key[24];
+	snprintf(key, sizeof(key), "h%016llx", (unsigned long long)hash);
+
+	return key;
+}
+
+static void LoadCornerCache(const string filePath, Size boardSize, map<uint64_t, CalibrationImage>& cache)
+{
+	FileStorage inStream(filePath, FileStorage::READ);
+
+	if (!inStream.isOpened())
+		return;
+
+	// Corners of a different board or found with other detection parameters don't apply
+	Size cachedBoardSize;
+	int detectionSize = 0, detectionFlags = 0, refinementWindow = 0, refinementIterations = 0;
+	double refinementEpsilon = 0;
 
-		bool hasCorners = findChessboardCorners(image, boardSize, corners);
+	inStream["boardSize"] >> cachedBoardSize;
+	inStream["detectionSize"] >> detectionSize;
+	inStream["detectionFlags"] >> detectionFlags;
+	inStream["refinementWindow"] >> refinementWindow;
+	inStream["refinementIterations"] >> refinementIterations;
+	inStream["refinementEpsilon"] >> refinementEpsilon;
 
-		if (hasCorners)
+	if (cachedBoardSize != boardSize || detectionSize != DetectionSize || detectionFlags != DetectionFlags || refinementWindow != MinRefinementWindow ||
+		refinementIterations != RefinementCriteria.maxCount || refinementEpsilon != RefinementCriteria.epsilon)
+		return;
+
+	FileNode images = inStream["images"];
+
+	for (FileNodeIterator it = images.begin(); it != images.end(); ++it)
+	{
+		CalibrationImage image;
+		string key = (*it).name();
+		unsigned long long hash = 0;
+
+		if (sscanf(key.c_str(), "h%llx", &hash) != 1)
+			continue;
+
+		image.hash = hash;
+
+		(*it)["size"] >> image.size;
+		image.found = (int)(*it)["found"] != 0;
+		(*it)["corners"] >> image.corners;
+		image.valid = true;
+
+		cache[image.hash] = image;
+	}
+}
+
+static void SaveCornerCache(const string filePath, Size boardSize, const map<uint64_t, CalibrationImage>& cache)
+{
+	FileStorage outStream(filePath, FileStorage::WRITE);
+
+	if (!outStream.isOpened())
+		return;
+
+	outStream << "boardSize" << boardSize << "detectionSize" << DetectionSize << "detectionFlags" << DetectionFlags << "refinementWindow" << MinRefinementWindow <<
+		"refinementIterations" << RefinementCriteria.maxCount << "refinementEpsilon" << RefinementCriteria.epsilon << "images" << "{";
+
+	for (const auto& entry : cache)
+	{
+		const CalibrationImage& image = entry.second;
+		outStream << HashKey(image.hash) << "{" << "size" << image.size << "found" << (int)image.found << "corners" << image.corners << "}";
+	}
+
+	outStream << "}";
+	outStream.release();
+}
+
+static bool ReadFileBytes(const path& filePath, vector<uchar>& bytes)
+{
+	ifstream file(filePath, ios::binary | ios::ate);
+
+	if (!file)
+		return false;
+
+	bytes.resize((size_t)file.tellg());
+	file.seekg(0);
+
+	return (bool)file.read((char*)bytes.data(), bytes.size());
+}
+
+CalibrationData CalibrateFromDirectory(const string directory, Size boardSize, float squareSize, const string cachePath)
+{
+	vector<path> files;
+
+	for (const auto& file : directory_iterator(directory))
+		if (file.is_regular_file())
+			files.push_back(file.path());
+
+	if (files.empty())
+		return CalibrationData();
+
+	string cacheFilePath = (filesystem::path(cachePath) / "calibration_corners.yml").string();
+	map<uint64_t, CalibrationImage> cache;
+	LoadCornerCache(cacheFilePath, boardSize, cache);
+
+	// Read, hash and, unless cached, decode and search every image in parallel
+	// The cache is only read in here, the new results are merged afterwards
+	vector<CalibrationImage> images(files.size());
+
+	parallel_for_(Range(0, (int)files.size()), [&](const Range& range)
+	{
+		vector<uchar> bytes;
+
+		for (int i = range.start; i < range.end; i++)
 		{
-			//cornerSubPix(gray, corners, Size(5, 5), Size(-1, -1),
-			//	TermCriteria(TermCriteria::EPS | TermCriteria::MAX_ITER, 3, 0.1));
+			if (!ReadFileBytes(files[i], bytes))
+				continue;
+
+			CalibrationImage& image = images[i];
+			image.hash = HashBytes(bytes);
+
+			auto cached = cache.find(image.hash);
 
-			drawChessboardCorners(duplicate, boardSize, corners, hasCorners);
+			if (cached != cache.end())
+			{
+				image = cached->second;
+				continue;
+			}
 
-			vector<Point3f> object;
+			Mat gray = imdecode(bytes, IMREAD_GRAYSCALE);
 
-			for (int i = 0; i < boardSize.height; i++)
-				for (int j = 0; j < boardSize.width; j++)
-					object.push_back(Point3f(j * squareSize, i * squareSize, 0));
+			if (gray.empty())
+				continue;
 
-			imagePoints.push_back(corners);
-			objectPoints.push_back(object);
+			image.size = gray.size();
+			image.found = FindCalibrationCorners(gray, boardSize, image.corners);
+			image.valid = true;
+		}
+	});
+
+	vector<vector<Point2f>> imagePoints;
+	Size imageSize;
+	bool cacheChanged = false;
+
+	for (CalibrationImage& image : images)
+	{
+		if (!image.valid)
+			continue;
+
+		if (cache.find(image.hash) == cache.end())
+		{
+			cache[image.hash] = image;
+			cacheChanged = true;
+		}
+
+		if (image.found)
+		{
+			imageSize = image.size;
+			imagePoints.push_back(image.corners);
 		}
 	}
 
-	// Get the calibration matrix and distortion coefficients from the chessboard corners
-	calibrateCamera(objectPoints, imagePoints, images[0].size(), calibrationData.camMatrix, 
-		calibrationData.distortion, rotationVecs, transformationVecs);
+	if (cacheChanged)
+	{
+		if (!exists(cachePath))
+			create_directories(cachePath);
 
-	return calibrationData;
+		SaveCornerCache(cacheFilePath, boardSize, cache);
+	}
+
+	return CalibrateFromCorners(imagePoints, imageSize, boardSize, squareSize);
 }
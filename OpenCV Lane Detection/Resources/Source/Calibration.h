@@ -17,9 +17,9 @@ struct CalibrationData
 	void OutputToFile(const string path)
 	{
 		if (!exists(path))
-			create_directory(path);
-		
-		FileStorage outStream(path + "\\calibration.yml", FileStorage::WRITE);
+			create_directories(path);
+
+		FileStorage outStream((filesystem::path(path) / "calibration.yml").string(), FileStorage::WRITE);
 
 		if (!outStream.isOpened())
 			return;
@@ -30,7 +30,7 @@ struct CalibrationData
 
 	bool LoadFromFile(const string path)
 	{
-		FileStorage inStream(path + "\\calibration.yml", FileStorage::READ);
+		FileStorage inStream((filesystem::path(path) / "calibration.yml").string(), FileStorage::READ);
 
 		if (!inStream.isOpened())
 			return false;
@@ -43,4 +43,11 @@ struct CalibrationData
 	}
 };
 
-CalibrationData Calibrate(const std::vector<cv::Mat>& images, cv::Size boardSize, float squareSize);
\ No newline at end of file
+// Finds the chessboard on a downscaled copy of the image and refines the corners at full resolution
+bool FindCalibrationCorners(const Mat& image, Size boardSize, vector<Point2f>& corners);
+
+CalibrationData Calibrate(const std::vector<cv::Mat>& images, cv::Size boardSize, float squareSize);
+
+// Calibrates with every image in the directory, decoding and detecting in parallel
+// The corners of each image are cached in cachePath/calibration_corners.yml by a hash of the file, so only new images are processed
+CalibrationData CalibrateFromDirectory(const string directory, Size boardSize, float squareSize, const string cachePath);
\ No newline at end of file
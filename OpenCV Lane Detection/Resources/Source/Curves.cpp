@@ -1,141 +1,239 @@
 #include "Curves.h"
+#include "Trace.h"
 
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
 #include <iostream>
+#include <cstring>
 
-Point FindInitialLanePoints(const Mat& in, const Range heightRange)
+void LaneMaskIndex::Allocate(Size maskSize, int bandRows)
 {
-	Mat lowerWindow = in(heightRange, Range::all());
+	rows = maskSize.height;
+	cols = maskSize.width;
+	this->bandRows = max(bandRows, 1);
+	bands = rows / this->bandRows;
+
+	columnCounts.create(bands + 1, cols, CV_32S);
+	countSums.create(bands + 1, cols + 1, CV_32S);
+	momentSums.create(bands + 1, cols + 1, CV_64F);
+
+	// The bottom boundary has nothing below it
+	columnCounts.row(0).setTo(Scalar::all(0));
+	countSums.row(0).setTo(Scalar::all(0));
+	momentSums.row(0).setTo(Scalar::all(0));
+}
 
-	Mat hist;
-	reduce(lowerWindow, hist, 0, REDUCE_SUM, CV_32F);
+void LaneMaskIndex::AddRow(const uchar* maskRow, int y)
+{
+	int fromBottom = rows - 1 - y;
+	int boundary = fromBottom / bandRows + 1;
 
-	Mat lowerLeft = hist(Range::all(), Range(0, in.cols / 2));
-	Mat lowerRight = hist(Range::all(), Range(in.cols / 2, hist.cols));
+	if (boundary > bands)
+		return;
 
-	float lMax = 0, rMax = 0;
-	int lMaxIndex, rMaxIndex;
+	// Every band carries on from the counts of the band below it
+	int* counts = columnCounts.ptr<int>(boundary);
 
-	for (int i = 0; i < lowerLeft.cols; i++)
-	{
-		float val = lowerLeft.at<float>(i);
+	if (fromBottom % bandRows == 0)
+		memcpy(counts, columnCounts.ptr<int>(boundary - 1), cols * sizeof(int));
 
-		if (lMax < val)
-		{
-			lMax = val;
-			lMaxIndex = i;
-		}
-	}
+	for (int x = 0; x < cols; x++)
+		counts[x] += maskRow[x];
 
-	for (int i = 0; i < lowerRight.cols; i++)
+	// The running sums along the boundary once its band is complete
+	if (fromBottom % bandRows == bandRows - 1)
 	{
-		float val = lowerRight.at<float>(i);
+		int* countSum = countSums.ptr<int>(boundary);
+		double* momentSum = momentSums.ptr<double>(boundary);
 
-		if (rMax < val)
+		countSum[0] = 0;
+		momentSum[0] = 0;
+
+		for (int x = 0; x < cols; x++)
 		{
-			rMax = val;
-			rMaxIndex = i;
+			countSum[x + 1] = countSum[x] + counts[x];
+			momentSum[x + 1] = momentSum[x] + (double)x * counts[x];
 		}
 	}
+}
 
-	return Point(lMaxIndex, rMaxIndex);
+void LaneMaskIndex::Build(const Mat& mask, int bandRows)
+{
+	CV_Assert(mask.type() == CV_8U);
+
+	Allocate(mask.size(), bandRows);
+
+	for (int y = mask.rows - 1; y >= 0; y--)
+		AddRow(mask.ptr<uchar>(y), y);
 }
 
-int FindWindowLanePoint(const Mat& window, Rect bounds, int minPixelCount)
+int LaneMaskIndex::Count(Rect window) const
 {
-	int pixelCount = countNonZero(window);
+	int x0 = clamp(window.x, 0, cols), x1 = clamp(window.x + window.width, 0, cols);
+	const int* top = countSums.ptr<int>(Boundary(window.y));
+	const int* bottom = countSums.ptr<int>(Boundary(window.y + window.height));
 
-	if (pixelCount == 0)
-		return bounds.width / 2;
+	return (top[x1] - top[x0]) - (bottom[x1] - bottom[x0]);
+}
 
-	Mat hist;
-	reduce(window, hist, 0, REDUCE_SUM, CV_32F);
-	
-	float average = 0.00f;
+double LaneMaskIndex::CentroidX(Rect window) const
+{
+	int count = Count(window);
 
-	for (int i = 0; i < hist.cols; i++)
-		average += hist.at<float>(i) * i;
+	if (count == 0)
+		return window.width / 2;
 
-	average /= pixelCount;
+	int x0 = clamp(window.x, 0, cols), x1 = clamp(window.x + window.width, 0, cols);
+	const double* top = momentSums.ptr<double>(Boundary(window.y));
+	const double* bottom = momentSums.ptr<double>(Boundary(window.y + window.height));
 
-	return (int)average;
+	return ((top[x1] - top[x0]) - (bottom[x1] - bottom[x0])) / count - window.x;
 }
 
-// Polynomial fit function adapted from:
-// https://windowsquestions.com/2021/07/07/polynomial-curve-fitting-in-opencv-c/
-Mat PolynomialFit(const vector<Point>& points, int order)
+void BinarizeLaneMask(const Mat& in, Mat& out, Size outSize, Point offset, int thresh, Range keepCols, int bandRows, LaneMaskIndex& index)
 {
-	cv::Mat U(points.size(), (order + 1), CV_32F);
-	cv::Mat Y(points.size(), 1, CV_32F);
+	CV_Assert(in.type() == CV_8U);
 
-	for (int i = 0; i < U.rows; i++)
+	out.create(outSize, CV_8U);
+	index.Allocate(outSize, bandRows);
+
+	// Columns of out that come from in and are kept
+	int x0 = max({ offset.x, keepCols.start, 0 });
+	int x1 = min({ offset.x + in.cols, keepCols.end, outSize.width });
+
+	// Bottom up, so every row is counted into the index right after it is written
+	for (int y = outSize.height - 1; y >= 0; y--)
 	{
-		float* rowPtr = U.ptr<float>(i);
+		uchar* outRow = out.ptr<uchar>(y);
+		int inY = y - offset.y;
+
+		memset(outRow, 0, outSize.width);
+
+		if (inY >= 0 && inY < in.rows)
+		{
+			const uchar* inRow = in.ptr<uchar>(inY) - offset.x;
 
-		for (int j = 0; j < U.cols; j++)
-			rowPtr[j] = pow(points[i].y, j);
+			for (int x = x0; x < x1; x++)
+				outRow[x] = inRow[x] > thresh;
+		}
+
+		index.AddRow(outRow, y);
 	}
+}
+
+// Peaks of the column histogram between two band boundaries in the left and the right half of the mask, the right one relative to the middle
+Point FindInitialLanePoints(const LaneMaskIndex& index, int bottom, int top)
+{
+	const int* topCounts = index.columnCounts.ptr<int>(top);
+	const int* bottomCounts = index.columnCounts.ptr<int>(bottom);
+	int midWidth = index.cols / 2;
 
-	for (int i = 0; i < Y.rows; i++)
+	int lMax = 0, rMax = 0;
+	int lMaxIndex = 0, rMaxIndex = 0;
+
+	for (int i = 0; i < midWidth; i++)
 	{
-		float* rowPtr = Y.ptr<float>(i);
-		rowPtr[0] = points[i].x;
+		int val = topCounts[i] - bottomCounts[i];
+
+		if (lMax < val)
+		{
+			lMax = val;
+			lMaxIndex = i;
+		}
 	}
 
-	cv::Mat K((order + 1), 1, CV_32F);
+	for (int i = midWidth; i < index.cols; i++)
+	{
+		int val = topCounts[i] - bottomCounts[i];
+
+		if (rMax < val)
+		{
+			rMax = val;
+			rMaxIndex = i - midWidth;
+		}
+	}
 
-	if (U.data != NULL)
-		K = (U.t() * U).inv() * U.t() * Y;
+	return Point(lMaxIndex, rMaxIndex);
+}
 
-	return K;
+int FindWindowLanePoint(const LaneMaskIndex& index, Rect bounds, int minPixelCount)
+{
+	return (int)index.CentroidX(bounds);
 }
 
-Mat PolynomialFit(const vector<Point2d>& points, int order)
+// Solves the normal equations of the quadratic least squares fit x = ay^2 + by + c
+// K is (c, b, a) as a 3x1 CV_32F matrix, the same layout the previous dense fit produced
+void QuadraticFitSums::Solve(Mat& K) const
 {
-	cv::Mat U(points.size(), (order + 1), CV_32F);
-	cv::Mat Y(points.size(), 1, CV_32F);
+	K.create(3, 1, CV_32F);
 
-	for (int i = 0; i < U.rows; i++)
+	// Not enough points for a quadratic, keep the curve flat
+	if (n < 3)
 	{
-		float* rowPtr = U.ptr<float>(i);
+		K.setTo(Scalar::all(0));
 
-		for (int j = 0; j < U.cols; j++)
-			rowPtr[j] = pow(points[i].y, j);
-	}
+		if (n > 0)
+			K.at<float>(0) = (float)(sumX / n);
 
-	for (int i = 0; i < Y.rows; i++)
-	{
-		float* rowPtr = Y.ptr<float>(i);
-		rowPtr[0] = points[i].x;
+		return;
 	}
 
-	cv::Mat K((order + 1), 1, CV_32F);
+	Matx33d A(
+		n, sumY, sumY2,
+		sumY, sumY2, sumY3,
+		sumY2, sumY3, sumY4);
+
+	Vec3d B(sumX, sumXY, sumXY2);
+	Vec3d solution;
 
-	if (U.data != NULL)
-		K = (U.t() * U).inv() * U.t() * Y;
+	if (!solve(A, B, solution, DECOMP_LU))
+		solve(A, B, solution, DECOMP_SVD);
+
+	for (int i = 0; i < 3; i++)
+		K.at<float>(i) = (float)solution[i];
+}
+
+Mat PolynomialFit(const vector<Point>& points, int order)
+{
+	CV_Assert(order == 2);
+
+	QuadraticFitSums sums;
+
+	for (const Point& point : points)
+		sums.Add(point.x, point.y);
+
+	Mat K;
+	sums.Solve(K);
 
 	return K;
 }
 
-vector<Point> GetCurvePoints(const Mat& K, const vector<Point>& points, int rows, int order)
+// Least squares is invariant to scaling the axes, so the fit in meters follows from the fit in pixels
+// x = mx * (a(y / my)^2 + b(y / my) + c)
+void ScaleCurveToMeters(const Mat& pixelK, Mat& realK, float metersPerPixelX, float metersPerPixelY)
 {
-	vector<Point> curvePoints;
-	
-	for (int j = 0; j < rows; j++)
-	{
-		Point2d point(0, j);
+	realK.create(3, 1, CV_32F);
 
-		for (int k = 0; k < order + 1; k++)
-		{
-			const float* rowPtr = K.ptr<float>(k);
-			point.x += rowPtr[0] * pow(j, k);
-		}
+	realK.at<float>(0) = pixelK.at<float>(0) * metersPerPixelX;
+	realK.at<float>(1) = pixelK.at<float>(1) * metersPerPixelX / metersPerPixelY;
+	realK.at<float>(2) = pixelK.at<float>(2) * metersPerPixelX / (metersPerPixelY * metersPerPixelY);
+}
 
-		curvePoints.push_back(point);
-	}
+// Evaluates the curve for every row with Horner's method into the reused point buffer
+void GetCurvePoints(const Mat& K, vector<Point>& curvePoints, int rows)
+{
+	double c = K.at<float>(0), b = K.at<float>(1), a = K.at<float>(2);
+
+	curvePoints.resize(rows);
+
+	for (int j = 0; j < rows; j++)
+		curvePoints[j] = Point(cvRound((a * j + b) * j + c), j);
+}
 
-	return curvePoints;
+// x = ay^2 + by + c
+float EvaluateCurve(const Mat& K, float y)
+{
+	return K.at<float>(2) * y * y + K.at<float>(1) * y + K.at<float>(0);
 }
 
 double GetRadiusOfCurvature(Mat K, float y)
@@ -147,9 +245,9 @@ double GetRadiusOfCurvature(Mat K, float y)
 	return pow(1 + pow(2 * a * y + b, 2), 1.5) / abs(2 * a);
 }
 
-void GetVehiclePosition(CurveFitData& data, float metersPerPixel)
+void GetVehiclePosition(CurveFitData& data, int width, float metersPerPixel)
 {
-	int midWidth = data.image.cols / 2;
+	int midWidth = width / 2;
 	
 	// Get the points at the bottom of the frame
 	int leftPoint = data.leftCurvePoints[data.leftCurvePoints.size() - 1].x;
@@ -160,16 +258,42 @@ void GetVehiclePosition(CurveFitData& data, float metersPerPixel)
 	data.vehiclePosition = (pixelPosition - midWidth) * metersPerPixel;
 }
 
-void CurveFit(const Mat& in, CurveFitData& outCurveData, float metersPerPixelX, float metersPerPixelY, int numWindows, int windowWidth, int minPixelCount)
+// Adds the coordinates of the nonzero pixels inside the bounds
+void GatherLanePixels(const Mat& in, Rect bounds, LanePixels& lanePixels)
+{
+	bounds &= Rect(0, 0, in.cols, in.rows);
+
+	for (int y = bounds.y; y < bounds.y + bounds.height; y++)
+	{
+		const uchar* rowPtr = in.ptr<uchar>(y);
+
+		for (int x = bounds.x; x < bounds.x + bounds.width; x++)
+			if (rowPtr[x])
+				lanePixels.Add(x, y);
+	}
+}
+
+// Slides the windows up from the bottom of the frame and collects the lane pixels inside them
+// The windows are positioned from the mask index, only the pixels that end up inside them are read from the mask
+void SlidingWindowLanePixels(const Mat& in, const LaneMaskIndex& index, CurveFitData& outCurveData, int numWindows, int windowWidth, int minPixelCount, LanePixels& leftLanePixels, LanePixels& rightLanePixels)
 {
+	TRACE_SCOPE("Sliding Windows");
+
+	leftLanePixels.Clear();
+	rightLanePixels.Clear();
+	outCurveData.leftWindows.clear();
+	outCurveData.rightWindows.clear();
+
 	int windowHeight = in.rows / numWindows;
 	int midImageWidth = in.cols / 2;
 	int midWindowWidth = windowWidth / 2;
 
-	outCurveData.image = in.clone() * 255;
+	// The windows have to stack up on the band boundaries of the index
+	CV_Assert(index.rows == in.rows && index.cols == in.cols && windowHeight % index.bandRows == 0);
 
-	// Find a good starting position for the bottom most window
-	Point centers = FindInitialLanePoints(in, Range(in.rows / 2, in.rows));
+	// Find a good starting position for the bottom most window in the lower half of the mask, rounded to whole bands
+	int lowerBands = min(index.bands, (int)lround(in.rows / 2.0 / index.bandRows));
+	Point centers = FindInitialLanePoints(index, 0, lowerBands);
 
 	// Define first window bounds
 	int currentLeftX = centers.x;
@@ -185,24 +309,15 @@ void CurveFit(const Mat& in, CurveFitData& outCurveData, float metersPerPixelX,
 		in.rows - windowHeight,
 		windowWidth, windowHeight);
 
-	vector<Point> leftLanePixels;
-	vector<Point> rightLanePixels;
-
-	Mat leftLane = Mat::zeros(Size(in.cols, in.rows), CV_8U);
-	Mat rightLane = Mat::zeros(Size(in.cols, in.rows), CV_8U);
-	
 	// For each of the windows, find the average x position and add reposition the window at thaat point
-	// Add the pixels in the window to a separate image, storing one lane line
+	// Gather the pixels in the window into the lane's pixel buffer, the windows of one lane never overlap
 	for (int i = 0; i < numWindows; i++)
 	{
 		leftWindowBounds.y = in.rows - (i + 1) * windowHeight;
 		rightWindowBounds.y = in.rows - (i + 1) * windowHeight;
 
-		Mat leftWindow = in(leftWindowBounds);
-		Mat rightWindow = in(rightWindowBounds);
-
-		int lanePointL = FindWindowLanePoint(leftWindow, leftWindowBounds, minPixelCount);
-		int lanePointR = FindWindowLanePoint(rightWindow, rightWindowBounds, minPixelCount);
+		int lanePointL = FindWindowLanePoint(index, leftWindowBounds, minPixelCount);
+		int lanePointR = FindWindowLanePoint(index, rightWindowBounds, minPixelCount);
 
 		currentLeftX += lanePointL - midWindowWidth;
 		currentRightX += lanePointR - midWindowWidth;
@@ -210,51 +325,237 @@ void CurveFit(const Mat& in, CurveFitData& outCurveData, float metersPerPixelX,
 		leftWindowBounds.x = clamp(currentLeftX - midWindowWidth, 0, in.cols - windowWidth);
 		rightWindowBounds.x = clamp(currentRightX - midWindowWidth, 0, in.cols - windowWidth);
 
-		leftWindow = in(leftWindowBounds);
-		rightWindow = in(rightWindowBounds);
-		
-		rectangle(outCurveData.image, leftWindowBounds, Scalar::all(255), 3);
-		rectangle(outCurveData.image, rightWindowBounds, Scalar::all(255), 3);
+		outCurveData.leftWindows.push_back(leftWindowBounds);
+		outCurveData.rightWindows.push_back(rightWindowBounds);
 
-		leftWindow.copyTo(leftLane(leftWindowBounds));
-		rightWindow.copyTo(rightLane(rightWindowBounds));
+		GatherLanePixels(in, leftWindowBounds, leftLanePixels);
+		GatherLanePixels(in, rightWindowBounds, rightLanePixels);
 	}
+}
 
-	// Find the lane pixel positions and curve fit them separately
-	findNonZero(leftLane, leftLanePixels);
-	findNonZero(rightLane, rightLanePixels);
+// Collects the lane pixels within a margin of a previously fitted curve, row by row
+void SearchAroundCurve(const Mat& in, const Mat& K, int margin, LanePixels& lanePixels)
+{
+	TRACE_SCOPE("Search Around Curve");
 
-	outCurveData.leftPixelK = PolynomialFit(leftLanePixels, 2);
-	outCurveData.rightPixelK = PolynomialFit(rightLanePixels, 2);
+	lanePixels.Clear();
 
-	outCurveData.leftCurvePoints = GetCurvePoints(outCurveData.leftPixelK, leftLanePixels, in.rows, 2);
-	outCurveData.rightCurvePoints = GetCurvePoints(outCurveData.rightPixelK, rightLanePixels, in.rows, 2);
+	for (int y = 0; y < in.rows; y++)
+	{
+		int center = cvRound(EvaluateCurve(K, (float)y));
+		GatherLanePixels(in, Rect(center - margin, y, margin * 2, 1), lanePixels);
+	}
+}
 
-	// Get the vehicle offset from the center of the lane
-	GetVehiclePosition(outCurveData, metersPerPixelX);
+// Fits both lanes in pixels, the fit in meters is derived from it in UpdateLaneGeometry
+void FitLaneCoefficients(const LanePixels& leftLanePixels, const LanePixels& rightLanePixels, CurveFitData& outCurveData)
+{
+	TRACE_SCOPE("Fit Lanes");
 
-	// Scale the pixel positions in terms of meters per pixel
-	vector<Point2d> leftLaneRealPoints;
-	vector<Point2d> rightLaneRealPoints;
+	QuadraticFitSums leftSums, rightSums;
 
-	for (Point2d point : leftLanePixels)
-		leftLaneRealPoints.emplace_back(point.x * metersPerPixelX, point.y * metersPerPixelY);
+	for (int i = 0; i < leftLanePixels.Size(); i++)
+		leftSums.Add(leftLanePixels.x[i], leftLanePixels.y[i]);
 
-	for (Point2d point : rightLanePixels)
-		rightLaneRealPoints.emplace_back(point.x * metersPerPixelX, point.y * metersPerPixelY);
+	for (int i = 0; i < rightLanePixels.Size(); i++)
+		rightSums.Add(rightLanePixels.x[i], rightLanePixels.y[i]);
 
-	outCurveData.leftRealK = PolynomialFit(leftLaneRealPoints, 2);
-	outCurveData.rightRealK = PolynomialFit(rightLaneRealPoints, 2);
+	leftSums.Solve(outCurveData.leftPixelK);
+	rightSums.Solve(outCurveData.rightPixelK);
+}
+
+// Coefficients in meters, curve points, vehicle position and radii from the fitted pixel coefficients
+void UpdateLaneGeometry(const Mat& in, CurveFitData& outCurveData, float metersPerPixelX, float metersPerPixelY)
+{
+	TRACE_SCOPE("Lane Geometry");
+
+	ScaleCurveToMeters(outCurveData.leftPixelK, outCurveData.leftRealK, metersPerPixelX, metersPerPixelY);
+	ScaleCurveToMeters(outCurveData.rightPixelK, outCurveData.rightRealK, metersPerPixelX, metersPerPixelY);
+
+	GetCurvePoints(outCurveData.leftPixelK, outCurveData.leftCurvePoints, in.rows);
+	GetCurvePoints(outCurveData.rightPixelK, outCurveData.rightCurvePoints, in.rows);
+
+	// Get the vehicle offset from the center of the lane
+	GetVehiclePosition(outCurveData, in.cols, metersPerPixelX);
 
 	outCurveData.leftRadius = GetRadiusOfCurvature(outCurveData.leftRealK, in.cols * metersPerPixelX);
 	outCurveData.rightRadius = GetRadiusOfCurvature(outCurveData.rightRealK, in.cols * metersPerPixelX);
+}
+
+// Renders straight at the requested size, the mask is scaled down first and everything else is drawn on top of it
+void DrawCurveFit(const Mat& in, const CurveFitData& curveData, Mat& out, Size size)
+{
+	Mat gray;
+	resize(in, gray, size);
+	gray.convertTo(gray, -1, 255); // Needs to be multiplied to be visible
+	cvtColor(gray, out, COLOR_GRAY2BGR);
+
+	double scaleX = (double)size.width / in.cols, scaleY = (double)size.height / in.rows;
+	int thickness = max(1, (int)lround(3 * min(scaleX, scaleY)));
+
+	auto scaleRect = [&](const Rect& rect)
+	{
+		return Rect(Point((int)lround(rect.x * scaleX), (int)lround(rect.y * scaleY)),
+			Point((int)lround(rect.br().x * scaleX), (int)lround(rect.br().y * scaleY)));
+	};
+
+	for (const Rect& window : curveData.leftWindows)
+		rectangle(out, scaleRect(window), Scalar::all(255), thickness);
+
+	for (const Rect& window : curveData.rightWindows)
+		rectangle(out, scaleRect(window), Scalar::all(255), thickness);
+
+	// One polyline per curve instead of a circle per row, in fixed point to keep the sub pixel position
+	const int shift = 4;
+	vector<Point> curve;
+
+	for (const vector<Point>* curvePoints : { &curveData.leftCurvePoints, &curveData.rightCurvePoints })
+	{
+		curve.clear();
+
+		for (const Point& point : *curvePoints)
+			curve.push_back(Point((int)lround(point.x * scaleX * (1 << shift)), (int)lround(point.y * scaleY * (1 << shift))));
+
+		polylines(out, curve, false, Scalar(255, 0, 255), thickness * 2, LINE_AA, shift);
+	}
+}
+
+void CurveFit(const Mat& in, const LaneMaskIndex& index, CurveFitData& outCurveData, float metersPerPixelX, float metersPerPixelY, int numWindows, int windowWidth, int minPixelCount)
+{
+	LanePixels leftLanePixels;
+	LanePixels rightLanePixels;
+
+	SlidingWindowLanePixels(in, index, outCurveData, numWindows, windowWidth, minPixelCount, leftLanePixels, rightLanePixels);
+
+	// Curve fit the lanes separately
+	FitLaneCoefficients(leftLanePixels, rightLanePixels, outCurveData);
+	UpdateLaneGeometry(in, outCurveData, metersPerPixelX, metersPerPixelY);
+}
+
+void TrackLanes(const Mat& in, const LaneMaskIndex& index, CurveFitData& outCurveData, LaneTrackerData& tracker, LaneTrackerArgs args, float metersPerPixelX, float metersPerPixelY, int numWindows, int windowWidth, int minPixelCount)
+{
+	// The pixel buffers are kept in the tracker so they stop allocating once they have grown
+	LanePixels& leftLanePixels = tracker.leftLanePixels;
+	LanePixels& rightLanePixels = tracker.rightLanePixels;
+
+	// Look around the previous curves first, the lanes barely move from one frame to the next
+	bool searchedAround = tracker.tracking;
+
+	if (searchedAround)
+	{
+		SearchAroundCurve(in, tracker.leftPixelK, args.margin, leftLanePixels);
+		SearchAroundCurve(in, tracker.rightPixelK, args.margin, rightLanePixels);
+
+		searchedAround = leftLanePixels.Size() >= args.minLanePixels && rightLanePixels.Size() >= args.minLanePixels;
+
+		outCurveData.leftWindows.clear();
+		outCurveData.rightWindows.clear();
+	}
+
+	// Fall back to the full sliding window search
+	if (!searchedAround)
+		SlidingWindowLanePixels(in, index, outCurveData, numWindows, windowWidth, minPixelCount, leftLanePixels, rightLanePixels);
+
+	bool confident = leftLanePixels.Size() >= args.minLanePixels && rightLanePixels.Size() >= args.minLanePixels;
+	bool hasPrevious = !tracker.leftPixelK.empty();
+
+	if (confident || !hasPrevious)
+	{
+		FitLaneCoefficients(leftLanePixels, rightLanePixels, outCurveData);
+
+		// A lane width far from the tracked one means one of the lanes was fit to something else
+		float bottom = (float)(in.rows - 1);
+		float laneWidth = EvaluateCurve(outCurveData.rightPixelK, bottom) - EvaluateCurve(outCurveData.leftPixelK, bottom);
+
+		if (laneWidth <= 0 || (tracker.laneWidth > 0 && abs(laneWidth - tracker.laneWidth) > args.maxLaneWidthChange * tracker.laneWidth))
+			confident = false;
+	}
+
+	if (confident && hasPrevious && tracker.lostFrames == 0)
+	{
+		// Smooth the coefficients over time
+		outCurveData.leftPixelK = args.smoothing * outCurveData.leftPixelK + (1 - args.smoothing) * tracker.leftPixelK;
+		outCurveData.rightPixelK = args.smoothing * outCurveData.rightPixelK + (1 - args.smoothing) * tracker.rightPixelK;
+	}
+	else if (!confident && hasPrevious)
+	{
+		// Keep the last good curves until the lanes are found again
+		tracker.leftPixelK.copyTo(outCurveData.leftPixelK);
+		tracker.rightPixelK.copyTo(outCurveData.rightPixelK);
+	}
+
+	if (confident || !hasPrevious)
+	{
+		float bottom = (float)(in.rows - 1);
+
+		outCurveData.leftPixelK.copyTo(tracker.leftPixelK);
+		outCurveData.rightPixelK.copyTo(tracker.rightPixelK);
+		tracker.laneWidth = EvaluateCurve(tracker.rightPixelK, bottom) - EvaluateCurve(tracker.leftPixelK, bottom);
+	}
+
+	tracker.lostFrames = confident ? 0 : tracker.lostFrames + 1;
+	tracker.tracking = confident;
+	tracker.searchedAround = searchedAround;
+
+	// Forget the tracked lane width once the lanes have been lost for a while, so a new width can be picked up
+	if (tracker.lostFrames > args.maxLostFrames)
+		tracker.laneWidth = 0;
+
+	// Change of the curves per frame, spread over the frames that were extrapolated since the last fit
+	if (!tracker.lastLeftK.empty())
+	{
+		float frames = (float)(tracker.extrapolatedFrames + 1);
+
+		tracker.leftMotionK = (outCurveData.leftPixelK - tracker.lastLeftK) / frames;
+		tracker.rightMotionK = (outCurveData.rightPixelK - tracker.lastRightK) / frames;
+	}
+
+	outCurveData.leftPixelK.copyTo(tracker.lastLeftK);
+	outCurveData.rightPixelK.copyTo(tracker.lastRightK);
+	tracker.extrapolatedFrames = 0;
+
+	UpdateLaneGeometry(in, outCurveData, metersPerPixelX, metersPerPixelY);
+}
+
+void ExtrapolateLanes(const Mat& in, CurveFitData& outCurveData, LaneTrackerData& tracker, float metersPerPixelX, float metersPerPixelY)
+{
+	tracker.extrapolatedFrames++;
+
+	outCurveData.leftPixelK = tracker.lastLeftK + tracker.leftMotionK * (float)tracker.extrapolatedFrames;
+	outCurveData.rightPixelK = tracker.lastRightK + tracker.rightMotionK * (float)tracker.extrapolatedFrames;
+	outCurveData.leftWindows.clear();
+	outCurveData.rightWindows.clear();
+
+	UpdateLaneGeometry(in, outCurveData, metersPerPixelX, metersPerPixelY);
+}
+
+void TransferLaneTracker(const LaneTrackerData& from, LaneTrackerData& to, double scaleX, double scaleY)
+{
+	// x = a*y^2 + b*y + c in the new sky view is scaleX * (a*(y/scaleY)^2 + b*(y/scaleY) + c)
+	auto scaleCurve = [&](const Mat& K, Mat& out)
+	{
+		if (K.empty())
+		{
+			out.release();
+			return;
+		}
+
+		K.copyTo(out);
 
-	// Draw the curves and convert color from gray to bgr
-	cvtColor(outCurveData.image, outCurveData.image, COLOR_GRAY2BGR);
+		for (int i = 0; i < 3; i++)
+			out.at<float>(i) = (float)(K.at<float>(i) * scaleX / pow(scaleY, i));
+	};
 
-	for (Point point : outCurveData.leftCurvePoints)
-		circle(outCurveData.image, point, 3, cv::Scalar(255, 0, 255), -1, LineTypes::LINE_AA);
+	scaleCurve(from.leftPixelK, to.leftPixelK);
+	scaleCurve(from.rightPixelK, to.rightPixelK);
+	scaleCurve(from.lastLeftK, to.lastLeftK);
+	scaleCurve(from.lastRightK, to.lastRightK);
+	scaleCurve(from.leftMotionK, to.leftMotionK);
+	scaleCurve(from.rightMotionK, to.rightMotionK);
 
-	for (Point point : outCurveData.rightCurvePoints)
-		circle(outCurveData.image, point, 3, cv::Scalar(255, 0, 255), -1, LineTypes::LINE_AA);
+	to.laneWidth = (float)(from.laneWidth * scaleX);
+	to.lostFrames = from.lostFrames;
+	to.tracking = from.tracking;
+	to.searchedAround = from.searchedAround;
+	to.extrapolatedFrames = from.extrapolatedFrames;
 }
\ No newline at end of file
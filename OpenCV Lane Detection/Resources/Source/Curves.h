@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <opencv2/core.hpp>
 
 using namespace std;
@@ -7,9 +8,136 @@ using namespace cv;
 
 struct CurveFitData
 {
-	Mat image, leftPixelK, rightPixelK, leftRealK, rightRealK;
+	Mat leftPixelK, rightPixelK, leftRealK, rightRealK;
 	vector<Point> leftCurvePoints, rightCurvePoints;
+	vector<Rect> leftWindows, rightWindows; // Windows of the last sliding window search, only kept for drawing
 	float leftRadius, rightRadius, vehiclePosition;
 };
 
-void CurveFit(const Mat& in, CurveFitData& outCurveData, float metersPerPixelX, float metersPerPixelY, int numWindows, int windowWidth, int minPixelCount);
\ No newline at end of file
+// Column counts of the 0/1 lane mask at every band boundary, counted from the bottom row up, and their running sums along each boundary
+// The column histogram of a window spanning whole bands is the difference of two columnCounts rows,
+// its pixel count and x centroid take four lookups each whatever the size of the window
+struct LaneMaskIndex
+{
+	int rows = 0, cols = 0, bandRows = 1, bands = 0;
+	Mat columnCounts; // (bands + 1) x cols CV_32S, row k counts the pixels of each column in the bottom k bands
+	Mat countSums, momentSums; // (bands + 1) x (cols + 1), running sums of columnCounts and of x * columnCounts, CV_32S and CV_64F
+
+	void Allocate(Size maskSize, int bandRows);
+	// Rows have to be added from the bottom row up, rows above the top band are ignored
+	void AddRow(const uchar* maskRow, int y);
+	void Build(const Mat& mask, int bandRows);
+
+	// Band boundary at a row, counted from 0 at the bottom of the mask
+	int Boundary(int row) const
+	{
+		CV_DbgAssert((rows - row) % bandRows == 0);
+		return clamp((rows - row) / bandRows, 0, bands);
+	}
+
+	// The windows have their top and bottom on band boundaries, their columns are clipped to the mask
+	int Count(Rect window) const;
+	// Mean x of the pixels in the window relative to its left edge, the middle of the window when it is empty
+	double CentroidX(Rect window) const;
+};
+
+// Writes in > thresh as a 0/1 mask into out at offset, the rest of out and the columns outside of keepCols are 0
+// The index over bands of bandRows is built in the same pass
+void BinarizeLaneMask(const Mat& in, Mat& out, Size outSize, Point offset, int thresh, Range keepCols, int bandRows, LaneMaskIndex& index);
+
+// Lane pixel coordinates as separate x and y arrays
+struct LanePixels
+{
+	vector<int> x, y;
+
+	void Add(int px, int py)
+	{
+		x.push_back(px);
+		y.push_back(py);
+	}
+
+	void Clear()
+	{
+		x.clear();
+		y.clear();
+	}
+
+	int Size() const
+	{
+		return (int)x.size();
+	}
+};
+
+// Power sums of the lane pixels for a quadratic least squares fit, accumulated in one pass without storing the points
+struct QuadraticFitSums
+{
+	double n = 0, sumY = 0, sumY2 = 0, sumY3 = 0, sumY4 = 0;
+	double sumX = 0, sumXY = 0, sumXY2 = 0;
+
+	void Add(double x, double y)
+	{
+		double y2 = y * y;
+
+		n += 1;
+		sumY += y;
+		sumY2 += y2;
+		sumY3 += y2 * y;
+		sumY4 += y2 * y2;
+		sumX += x;
+		sumXY += x * y;
+		sumXY2 += x * y2;
+	}
+
+	void Solve(Mat& K) const;
+};
+
+struct LaneTrackerArgs
+{
+	int margin; // Half width of the band searched around the previous curves
+	int minLanePixels; // Pixels needed on each lane to trust a fit
+	float smoothing; // Weight of the new coefficients when smoothing over time
+	float maxLaneWidthChange; // Relative change in lane width at the bottom of the frame that is still trusted
+	int maxLostFrames; // Frames without a trusted fit before the tracked lane width is forgotten
+};
+
+// State carried between frames by TrackLanes
+struct LaneTrackerData
+{
+	Mat leftPixelK, rightPixelK;
+	LanePixels leftLanePixels, rightLanePixels;
+	float laneWidth = 0;
+	int lostFrames = 0;
+	bool tracking = false, searchedAround = false;
+
+	// Output curves of the last fitted frame and their change per frame, for frames that skip the lane search
+	Mat lastLeftK, lastRightK, leftMotionK, rightMotionK;
+	int extrapolatedFrames = 0;
+
+	bool CanExtrapolate() const
+	{
+		return !leftMotionK.empty();
+	}
+
+	// Forgets the lanes as if no frame had been seen yet, the pixel buffers keep their capacity
+	void Reset()
+	{
+		for (Mat* K : { &leftPixelK, &rightPixelK, &lastLeftK, &lastRightK, &leftMotionK, &rightMotionK })
+			K->release();
+
+		laneWidth = 0;
+		lostFrames = 0;
+		tracking = searchedAround = false;
+		extrapolatedFrames = 0;
+	}
+};
+
+Mat PolynomialFit(const vector<Point>& points, int order);
+// Draws the mask, the search windows and the curves at any size, only called when the view is wanted
+void DrawCurveFit(const Mat& in, const CurveFitData& curveData, Mat& out, Size size);
+void CurveFit(const Mat& in, const LaneMaskIndex& index, CurveFitData& outCurveData, float metersPerPixelX, float metersPerPixelY, int numWindows, int windowWidth, int minPixelCount);
+void TrackLanes(const Mat& in, const LaneMaskIndex& index, CurveFitData& outCurveData, LaneTrackerData& tracker, LaneTrackerArgs args, float metersPerPixelX, float metersPerPixelY, int numWindows, int windowWidth, int minPixelCount);
+// Moves the curves on from the last fitted frame without looking at the mask, in only gives the sky view size
+// Needs two fitted frames first, see LaneTrackerData::CanExtrapolate()
+void ExtrapolateLanes(const Mat& in, CurveFitData& outCurveData, LaneTrackerData& tracker, float metersPerPixelX, float metersPerPixelY);
+// Hands the tracked lanes over to a tracker at another resolution, scaleX and scaleY go from the old sky view to the new one
+void TransferLaneTracker(const LaneTrackerData& from, LaneTrackerData& to, double scaleX, double scaleY);
\ No newline at end of file
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "Trace.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+using namespace std;
+using namespace cv;
+
+// Named intermediate views of the pipeline stages, only rendered while something is subscribed to them
+// A stage offers a view with Tap(), which costs one empty loop when nobody subscribed
+struct DebugTaps
+{
+	struct View
+	{
+		string name;
+		Size size; // Empty for the native size of the stage output
+		Mat image;
+		bool rendered = false;
+	};
+
+	vector<View> views;
+	bool paused = false; // Set by the frame scheduler while over budget, nothing is rendered then
+
+	// The same view can be subscribed at several sizes, e.g. in its own window and in the montage
+	void Subscribe(const string& name, Size size = Size())
+	{
+		for (const View& view : views)
+			if (view.name == name && view.size == size)
+				return;
+
+		views.push_back({ name, size });
+	}
+
+	void Unsubscribe(const string& name)
+	{
+		views.erase(remove_if(views.begin(), views.end(), [&](const View& view) { return view.name == name; }), views.end());
+	}
+
+	bool Empty() const { return views.empty(); }
+
+	// Marks the views of the previous frame as stale
+	void BeginFrame()
+	{
+		for (View& view : views)
+			view.rendered = false;
+	}
+
+	// Calls render(out, size) once per subscription of the view, size is the subscribed one or else nativeSize
+	template <typename Render>
+	void Tap(const char* name, Size nativeSize, Render render)
+	{
+		if (paused)
+			return;
+
+		for (View& view : views)
+		{
+			if (view.name != name)
+				continue;
+
+			TRACE_SCOPE(name);
+			render(view.image, view.size.empty() ? nativeSize : view.size);
+			view.rendered = true;
+		}
+	}
+
+	// The view rendered this frame, or nullptr
+	const Mat* Find(const string& name, Size size = Size()) const
+	{
+		for (const View& view : views)
+			if (view.rendered && view.name == name && view.size == size)
+				return &view.image;
+
+		return nullptr;
+	}
+};
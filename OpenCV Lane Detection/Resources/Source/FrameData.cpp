@@ -0,0 +1,278 @@
+#include "FrameData.h"
+
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+
+using namespace filesystem;
+
+void LatencySketch::Add(double seconds)
+{
+	int bucket = 0;
+
+	if (seconds > MinSeconds)
+		bucket = std::min((int)(std::log10(seconds / MinSeconds) * BucketsPerDecade), NumBuckets - 1);
+
+	buckets[bucket]++;
+	count++;
+	max = std::max(max, seconds);
+}
+
+void LatencySketch::Reset()
+{
+	buckets.fill(0);
+	count = 0;
+	max = 0;
+}
+
+double LatencySketch::Percentile(double percentile) const
+{
+	if (count == 0)
+		return 0;
+
+	uint64_t rank = (uint64_t)std::ceil(percentile / 100.0 * count);
+	uint64_t seen = 0;
+
+	for (int i = 0; i < NumBuckets; i++)
+	{
+		seen += buckets[i];
+
+		// Report the middle of the bucket, but never more than the largest sample
+		if (seen >= rank && seen > 0)
+			return std::min(MinSeconds * std::pow(10.0, (i + 0.5) / BucketsPerDecade), max);
+	}
+
+	return max;
+}
+
+const char* const FrameData::StageNames[NumStages] = {
+	"Undistort", "Sky View", "Lane Filter", "Curve Fit", "Projection", "Combine"
+};
+
+FrameData::FrameData(size_t capacity) : ring(std::max<size_t>(capacity, 1))
+{
+	flushBuffer.reserve(ring.size());
+}
+
+FrameData::~FrameData()
+{
+	StopFlusher();
+}
+
+double FrameData::StageTime(const FrameRecord& record, int stage)
+{
+	switch (stage)
+	{
+	case 0: return record.undistortTime;
+	case 1: return record.skyViewTime;
+	case 2: return record.laneFilterTime;
+	case 3: return record.curveFitTime;
+	case 4: return record.projectionTime;
+	default: return record.combineTime;
+	}
+}
+
+void FrameData::Add(const FrameRecord& record)
+{
+	lock_guard<mutex> guard(lock);
+
+	ring[written % ring.size()] = record;
+	written++;
+
+	for (int i = 0; i < NumStages; i++)
+		sketches[i].Add(StageTime(record, i));
+}
+
+void FrameData::OutputToConsole(double intervalSeconds)
+{
+	auto now = chrono::steady_clock::now();
+
+	if (now - lastConsoleOutput < chrono::duration<double>(intervalSeconds))
+		return;
+
+	lastConsoleOutput = now;
+
+	array<LatencySketch, NumStages> stats;
+	uint64_t frames;
+	{
+		lock_guard<mutex> guard(lock);
+		stats = sketches;
+		frames = written;
+	}
+
+	// Build the whole report first so the console is written and flushed once
+	string report = "Frames: " + to_string(frames) + " (p50 / p95 / p99 / max ms)\n";
+	char line[128];
+
+	for (int i = 0; i < NumStages; i++)
+	{
+		snprintf(line, sizeof(line), "%s Time: %.3f / %.3f / %.3f / %.3f\n", StageNames[i],
+			stats[i].Percentile(50) * 1000, stats[i].Percentile(95) * 1000, stats[i].Percentile(99) * 1000, stats[i].Max() * 1000);
+		report += line;
+	}
+
+	fputs(report.c_str(), stdout);
+	fflush(stdout);
+}
+
+void FrameData::OutputMostRecentToConsole()
+{
+	FrameRecord record;
+	{
+		lock_guard<mutex> guard(lock);
+
+		if (written == 0)
+			return;
+
+		record = ring[(written - 1) % ring.size()];
+	}
+
+	printf("Undistort Time: %f\nSky View Time: %f\nLane Filter Time: %f\nCurve Fit Time: %f\nProjection Time: %f\nCombine Time: %f\n\n",
+		record.undistortTime, record.skyViewTime, record.laneFilterTime, record.curveFitTime, record.projectionTime, record.combineTime);
+}
+
+void FrameData::OutputToFile(const string path)
+{
+	if (!exists(path))
+		create_directories(path);
+
+	FileStorage outStream((filesystem::path(path) / "frame_data.yml").string(), FileStorage::WRITE);
+
+	if (!outStream.isOpened())
+		return;
+
+	lock_guard<mutex> guard(lock);
+
+	// Percentiles of every stage over the whole run
+	for (int i = 0; i < NumStages; i++)
+	{
+		Mat percentiles = (Mat_<double>(1, 4) << sketches[i].Percentile(50), sketches[i].Percentile(95), sketches[i].Percentile(99), sketches[i].Max());
+		outStream << string(StageNames[i]) + " Time Percentiles" << percentiles;
+	}
+
+	// The most recent frames, oldest first
+	size_t numRecords = (size_t)std::min<uint64_t>(written, ring.size());
+	Mat records((int)numRecords, 13, CV_64F);
+
+	for (size_t i = 0; i < numRecords; i++)
+	{
+		const FrameRecord& record = ring[(written - numRecords + i) % ring.size()];
+		double* rowPtr = records.ptr<double>((int)i);
+
+		rowPtr[0] = (double)record.frameIndex;
+
+		for (int j = 0; j < NumStages; j++)
+			rowPtr[j + 1] = StageTime(record, j);
+
+		rowPtr[7] = record.leftRadius;
+		rowPtr[8] = record.rightRadius;
+		rowPtr[9] = record.vehiclePosition;
+		rowPtr[10] = record.processingLevel;
+		rowPtr[11] = record.lanesExtrapolated;
+		rowPtr[12] = record.latency;
+	}
+
+	outStream << "Frames" << (double)written <<
+		"Recent Frame Columns" << "index, undistort, sky view, lane filter, curve fit, projection, combine, left radius, right radius, vehicle position, level, extrapolated, latency" <<
+		"Recent Frames" << records;
+
+	outStream.release();
+}
+
+void FrameData::StartFlusher(const string path, double intervalSeconds)
+{
+	StopFlusher();
+
+	if (!exists(path))
+		create_directories(path);
+
+	flushPath = path;
+	flushInterval = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(intervalSeconds));
+	flusherRunning = true;
+
+	flusher = thread([this]()
+	{
+		unique_lock<mutex> guard(flusherLock);
+
+		while (flusherRunning)
+		{
+			flusherWake.wait_for(guard, flushInterval);
+			Flush();
+		}
+	});
+}
+
+void FrameData::StopFlusher()
+{
+	if (!flusher.joinable())
+		return;
+
+	{
+		lock_guard<mutex> guard(flusherLock);
+		flusherRunning = false;
+	}
+
+	flusherWake.notify_all();
+	flusher.join();
+}
+
+// Runs on the flusher thread, copies the new records out of the ring and writes them without holding the lock
+void FrameData::Flush()
+{
+	array<LatencySketch, NumStages> stats;
+	flushBuffer.clear();
+
+	{
+		lock_guard<mutex> guard(lock);
+
+		// Records that were overwritten before they could be flushed are counted and skipped
+		if (written - flushed > ring.size())
+		{
+			dropped += written - flushed - ring.size();
+			flushed = written - ring.size();
+		}
+
+		for (; flushed < written; flushed++)
+			flushBuffer.push_back(ring[flushed % ring.size()]);
+
+		stats = sketches;
+	}
+
+	string dataPath = (filesystem::path(flushPath) / "frame_data.csv").string();
+	bool writeHeader = !exists(dataPath);
+
+	if (FILE* file = fopen(dataPath.c_str(), "a"))
+	{
+		if (writeHeader)
+			fputs("frame,undistort,sky_view,lane_filter,curve_fit,projection,combine,left_radius,right_radius,vehicle_position,level,extrapolated,latency\n", file);
+
+		for (const FrameRecord& record : flushBuffer)
+		{
+			fprintf(file, "%lld,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.3f,%.3f,%.4f,%d,%d,%.6f\n", (long long)record.frameIndex,
+				record.undistortTime, record.skyViewTime, record.laneFilterTime, record.curveFitTime, record.projectionTime, record.combineTime,
+				record.leftRadius, record.rightRadius, record.vehiclePosition, record.processingLevel, (int)record.lanesExtrapolated, record.latency);
+		}
+
+		fclose(file);
+	}
+
+	WriteStats((filesystem::path(flushPath) / "frame_stats.csv").string(), stats);
+}
+
+void FrameData::WriteStats(const string& filePath, const array<LatencySketch, NumStages>& stats)
+{
+	FILE* file = fopen(filePath.c_str(), "w");
+
+	if (!file)
+		return;
+
+	fprintf(file, "stage,count,p50,p95,p99,max,dropped_records\n");
+
+	for (int i = 0; i < NumStages; i++)
+	{
+		fprintf(file, "%s,%llu,%.6f,%.6f,%.6f,%.6f,%llu\n", StageNames[i], (unsigned long long)stats[i].Count(),
+			stats[i].Percentile(50), stats[i].Percentile(95), stats[i].Percentile(99), stats[i].Max(), (unsigned long long)dropped);
+	}
+
+	fclose(file);
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+
+using namespace std;
+using namespace cv;
+
+// Results and stage timings of a single frame, filled in by ProcessFrame
+struct FrameRecord
+{
+	int64 frameIndex = 0;
+	double undistortTime = 0, skyViewTime = 0,
+		laneFilterTime = 0, curveFitTime = 0,
+		projectionTime = 0, combineTime = 0;
+	float leftRadius = 0, rightRadius = 0,
+		vehiclePosition = 0;
+	// Sky view pixel curves as (c, b, a) for x = a*y^2 + b*y + c
+	float leftK[3] = {}, rightK[3] = {};
+	// Decision of the frame scheduler and the time from decoding to the end of ProcessFrame
+	int processingLevel = 0;
+	bool lanesExtrapolated = false;
+	double latency = 0;
+};
+
+// Streaming percentiles of a stage time in fixed memory
+// Samples are counted in logarithmic buckets from 1us to 10s, about 2.3% apart
+class LatencySketch
+{
+public:
+	void Add(double seconds);
+	void Reset();
+
+	double Percentile(double percentile) const;
+	double Max() const { return max; }
+	uint64_t Count() const { return count; }
+
+private:
+	static constexpr double MinSeconds = 1e-6;
+	static constexpr int BucketsPerDecade = 100;
+	static constexpr int NumBuckets = BucketsPerDecade * 7;
+
+	array<uint32_t, NumBuckets> buckets = {};
+	uint64_t count = 0;
+	double max = 0;
+};
+
+// Telemetry of the processed frames with constant memory regardless of how long the stream runs
+// The most recent records are kept in a fixed ring, every stage time also goes into a percentile sketch
+class FrameData
+{
+public:
+	static constexpr int NumStages = 6;
+	static const char* const StageNames[NumStages];
+
+	FrameData(size_t capacity = 4096);
+	~FrameData();
+
+	FrameData(const FrameData&) = delete;
+	FrameData& operator=(const FrameData&) = delete;
+
+	void Add(const FrameRecord& record);
+
+	// Prints the stage percentiles, at most once per interval so it stays off the hot path
+	void OutputToConsole(double intervalSeconds);
+	void OutputMostRecentToConsole();
+
+	// Writes the stage percentiles and the records still in the ring
+	void OutputToFile(const string path);
+
+	// Periodically appends the new records to frame_data.csv and rewrites frame_stats.csv from a background thread
+	void StartFlusher(const string path, double intervalSeconds);
+	void StopFlusher();
+
+private:
+	static double StageTime(const FrameRecord& record, int stage);
+
+	void Flush();
+	void WriteStats(const string& filePath, const array<LatencySketch, NumStages>& stats);
+
+	mutex lock;
+	vector<FrameRecord> ring;
+	uint64_t written = 0, flushed = 0, dropped = 0;
+	array<LatencySketch, NumStages> sketches;
+
+	string flushPath;
+	vector<FrameRecord> flushBuffer;
+	thread flusher;
+	mutex flusherLock;
+	condition_variable flusherWake;
+	bool flusherRunning = false;
+	chrono::steady_clock::duration flushInterval;
+
+	chrono::steady_clock::time_point lastConsoleOutput;
+};
@@ -0,0 +1,213 @@
+#include "FramePool.h"
+#include "FrameProcessing.h"
+#include "Trace.h"
+
+#include <thread>
+
+FramePool::FramePool(const CalibrationData& calibrationData, const PartUndistortMapData& undistortMapData, const ViewTransformData& viewTransform, FramePoolArgs args) :
+    calibrationData(calibrationData), undistortMapData(undistortMapData), viewTransform(viewTransform), args(args)
+{
+    this->args.numWorkers = max(this->args.numWorkers, 1);
+    this->args.segmentFrames = max(this->args.segmentFrames, 1);
+    this->args.warmupFrames = max(this->args.warmupFrames, 0);
+
+    if (this->args.maxSegmentsInFlight <= 0)
+        this->args.maxSegmentsInFlight = this->args.numWorkers + this->args.numWorkers / 2 + 1;
+}
+
+int64 FramePool::Run(FrameSource& video, const function<void(Mat& frame, FrameRecord& frameRecord)>& emit)
+{
+    // Every worker owns a context, sized up front so no segment allocates
+    contexts.clear();
+
+    for (int i = 0; i < args.numWorkers; i++)
+    {
+        auto context = make_unique<PipelineContext>();
+        context->Allocate(viewTransform, args.filterInSkyView);
+        SubscribeDebugViews(context->debugTaps, video.FrameSize(), false, args.combineStepsInFinalFrame);
+        contexts.push_back(std::move(context));
+    }
+
+    pendingSegments.clear();
+    finishedSegments.clear();
+    decodedSegments = emittedSegments = 0;
+    decodeFinished = false;
+
+    // The parallelism comes from whole frames side by side, so keep OpenCV from oversubscribing the cores
+    int defaultThreads = getNumThreads();
+
+    if (args.numWorkers > 1)
+        setNumThreads(1);
+
+    thread decoder(&FramePool::Decode, this, ref(video));
+    vector<thread> workers;
+
+    for (unique_ptr<PipelineContext>& context : contexts)
+        workers.emplace_back(&FramePool::Worker, this, ref(*context));
+
+    // Emit the segments strictly in order, whichever worker finishes first
+    int64 frameCount = 0;
+
+    for (;;)
+    {
+        unique_ptr<Segment> segment;
+
+        {
+            unique_lock<mutex> guard(lock);
+            segmentFinished.wait(guard, [&]() { return finishedSegments.count(emittedSegments) > 0 || (decodeFinished && emittedSegments == decodedSegments); });
+
+            auto next = finishedSegments.find(emittedSegments);
+
+            if (next == finishedSegments.end())
+                break;
+
+            segment = std::move(next->second);
+            finishedSegments.erase(next);
+        }
+
+        for (size_t i = segment->warmupFrames; i < segment->frames.size(); i++, frameCount++)
+            emit(segment->frames[i], segment->records[i]);
+
+        {
+            lock_guard<mutex> guard(lock);
+            emittedSegments++;
+        }
+
+        segmentEmitted.notify_one();
+    }
+
+    decoder.join();
+
+    for (thread& worker : workers)
+        worker.join();
+
+    setNumThreads(defaultThreads);
+
+    return frameCount;
+}
+
+void FramePool::Decode(FrameSource& video)
+{
+    TRACE_THREAD_NAME("Decode");
+
+    int64 frameIndex = 0;
+    vector<Mat> warmup; // Copies of the last frames of the previous segment, the originals get drawn over
+
+    for (int64 index = 0;; index++)
+    {
+        // Stay a bounded number of segments ahead of the output
+        {
+            unique_lock<mutex> guard(lock);
+            segmentEmitted.wait(guard, [&]() { return decodedSegments - emittedSegments < args.maxSegmentsInFlight; });
+        }
+
+        auto segment = make_unique<Segment>();
+        segment->index = index;
+        segment->warmupFrames = (int)warmup.size();
+        segment->firstFrame = frameIndex - segment->warmupFrames;
+        segment->decodeTime = chrono::steady_clock::now();
+        segment->frames.swap(warmup);
+
+        {
+            TRACE_SCOPE("Decode Segment");
+
+            for (int i = 0; i < args.segmentFrames; i++)
+            {
+                Mat frame;
+
+                if (!video.Read(frame))
+                    break;
+
+                segment->frames.push_back(frame);
+                frameIndex++;
+            }
+        }
+
+        int decodedFrames = (int)segment->frames.size() - segment->warmupFrames;
+
+        if (decodedFrames == 0)
+            break;
+
+        for (size_t i = segment->frames.size() - min<size_t>(segment->frames.size(), args.warmupFrames); i < segment->frames.size(); i++)
+            warmup.push_back(segment->frames[i].clone());
+
+        segment->records.resize(segment->frames.size());
+
+        {
+            lock_guard<mutex> guard(lock);
+            pendingSegments.push_back(std::move(segment));
+            decodedSegments++;
+        }
+
+        segmentDecoded.notify_one();
+
+        // A short segment is the end of the video
+        if (decodedFrames < args.segmentFrames)
+            break;
+    }
+
+    {
+        lock_guard<mutex> guard(lock);
+        decodeFinished = true;
+    }
+
+    segmentDecoded.notify_all();
+    segmentFinished.notify_all();
+}
+
+// Workers take the oldest decoded segment, so whichever worker is free picks up the next piece of the video
+void FramePool::Worker(PipelineContext& context)
+{
+    TRACE_THREAD_NAME("Worker");
+
+    for (;;)
+    {
+        unique_ptr<Segment> segment;
+
+        {
+            unique_lock<mutex> guard(lock);
+            segmentDecoded.wait(guard, [&]() { return !pendingSegments.empty() || decodeFinished; });
+
+            if (pendingSegments.empty())
+                return;
+
+            segment = std::move(pendingSegments.front());
+            pendingSegments.pop_front();
+        }
+
+        ProcessSegment(*segment, context);
+
+        {
+            lock_guard<mutex> guard(lock);
+            int64 index = segment->index;
+            finishedSegments[index] = std::move(segment);
+        }
+
+        segmentFinished.notify_one();
+    }
+}
+
+void FramePool::ProcessSegment(Segment& segment, PipelineContext& context)
+{
+    TRACE_SCOPE("Segment");
+
+    // Every segment starts without lanes, the warmup frames bring the tracker close to where the previous segment left it
+    // They are neither drawn nor published
+    context.laneTracker.Reset();
+    context.decodeTime = segment.decodeTime;
+
+    for (size_t i = 0; i < segment.frames.size(); i++)
+    {
+        bool warmup = (int)i < segment.warmupFrames;
+        FrameRecord& frameRecord = segment.records[i];
+        frameRecord.frameIndex = segment.firstFrame + (int64)i;
+
+        context.renderOutput = args.renderOutput && !warmup;
+        context.resultPublisher = warmup ? nullptr : args.resultPublisher;
+
+        ProcessFrame(segment.frames[i], calibrationData, undistortMapData, viewTransform, context, frameRecord, args.combineStepsInFinalFrame, args.filterInSkyView);
+    }
+
+    for (int i = 0; i < segment.warmupFrames; i++)
+        segment.frames[i].release();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Calibration.h"
+#include "Undistortion.h"
+#include "ViewTransform.h"
+#include "PipelineContext.h"
+#include "FrameData.h"
+#include "FrameSource.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <opencv2/core.hpp>
+
+using namespace std;
+using namespace cv;
+
+struct FramePoolArgs
+{
+    int numWorkers = 1;
+    int segmentFrames = 16; // Consecutive frames one worker tracks the lanes through
+    int warmupFrames = 2; // Frames before a segment processed again to pick the lanes up, their results are thrown away
+    int maxSegmentsInFlight = 0; // Decoded but not yet emitted, bounds the memory, 0 for one and a half per worker
+    bool filterInSkyView = false;
+    bool combineStepsInFinalFrame = false;
+    bool renderOutput = true;
+    LaneResultPublisher* resultPublisher = nullptr; // Frames are published as they finish, so out of order
+};
+
+// Processes a recorded video on a pool of workers, a segment of consecutive frames at a time, and hands the results back in order
+// Only the lane tracker carries state from frame to frame, so every segment starts it afresh and warms it up on the frames before it
+// The results then only depend on the segment length, not on the number of workers or on which worker got which segment
+// The decoder stays a bounded number of segments ahead of the output, finished segments wait in a reorder buffer until their turn
+class FramePool
+{
+public:
+    FramePool(const CalibrationData& calibrationData, const PartUndistortMapData& undistortMapData, const ViewTransformData& viewTransform, FramePoolArgs args);
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    // Decodes and processes the video to its end, emit gets every frame and its record in frame order on the calling thread
+    // Returns the number of frames processed
+    int64 Run(FrameSource& video, const function<void(Mat& frame, FrameRecord& frameRecord)>& emit);
+
+private:
+    struct Segment
+    {
+        int64 index = 0;
+        int64 firstFrame = 0; // Frame index of frames[0], the warmup frames come first
+        int warmupFrames = 0;
+        chrono::steady_clock::time_point decodeTime;
+        vector<Mat> frames;
+        vector<FrameRecord> records;
+    };
+
+    void Decode(FrameSource& video);
+    void Worker(PipelineContext& context);
+    void ProcessSegment(Segment& segment, PipelineContext& context);
+
+    const CalibrationData& calibrationData;
+    const PartUndistortMapData& undistortMapData;
+    const ViewTransformData& viewTransform;
+    FramePoolArgs args;
+
+    vector<unique_ptr<PipelineContext>> contexts;
+
+    // Guards everything below, a segment takes long enough to process that one lock is never contended
+    mutex lock;
+    condition_variable segmentDecoded, segmentFinished, segmentEmitted;
+    deque<unique_ptr<Segment>> pendingSegments;
+    map<int64, unique_ptr<Segment>> finishedSegments; // The reorder buffer, by segment index
+    int64 decodedSegments = 0, emittedSegments = 0;
+    bool decodeFinished = false;
+};
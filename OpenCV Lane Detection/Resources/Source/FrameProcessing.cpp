@@ -1,102 +1,246 @@
 #include "FrameProcessing.h"
 
-void ProcessFrame(Mat& frame, const CalibrationData& calibrationData, const PartUndistortMapData& undistortMapData, FrameData& frameData, bool showStepsInNewWindows, bool combineStepsInFinalFrame)
+// The views of the montage in the top row of the final frame, from left to right
+static const char* const MontageViews[] = { "Sky View", "Color Threshold", "Sobel Threshold", "Lane Filter", "Curve Fitting" };
+
+void SubscribeDebugViews(DebugTaps& debugTaps, Size frameSize, bool showStepsInNewWindows, bool combineStepsInFinalFrame)
+{
+    if (showStepsInNewWindows)
+        for (const char* name : { "Sky View", "Color Threshold", "Sobel Threshold", "Lane Filter", "Curve Fitting", "Lane Projection" })
+            debugTaps.Subscribe(name);
+
+    // The montage views are rendered straight at 1/5 of the frame size
+    if (combineStepsInFinalFrame)
+        for (const char* name : MontageViews)
+            debugTaps.Subscribe(name, frameSize / 5);
+}
+
+void ShowDebugViews(const DebugTaps& debugTaps)
+{
+    for (const DebugTaps::View& view : debugTaps.views)
+        if (view.rendered && view.size.empty())
+            imshow(view.name, view.image);
+}
+
+// The Mat is the only header of its whole buffer, so the buffer can change hands without anyone else seeing it
+static bool OwnsWholeBuffer(const Mat& mat)
+{
+    return mat.u != nullptr && mat.u->refcount == 1 && mat.isContinuous() && mat.data == mat.datastart && (size_t)(mat.dataend - mat.datastart) == mat.u->size;
+}
+
+// Renders a mask at the view size, scaled to be visible
+static void RenderMask(const Mat& mask, Mat& out, Size size, double scale)
+{
+    if (size == mask.size())
+    {
+        mask.convertTo(out, -1, scale);
+        return;
+    }
+
+    resize(mask, out, size);
+    out.convertTo(out, -1, scale);
+}
+
+void ProcessFrame(Mat& frame, const CalibrationData& calibrationData, const PartUndistortMapData& undistortMapData, const ViewTransformData& viewTransform, PipelineContext& context, FrameRecord& frameRecord, bool combineStepsInFinalFrame, bool filterInSkyView)
 {
-    TickMeter timer;
-    timer.start();
+    TRACE_FRAME(frameRecord.frameIndex);
+    TRACE_SCOPE("ProcessFrame");
+
+    StageTimer timer;
+    timer.Start("Undistort");
+
+    // Every intermediate result lives in the context, so the buffers are reused from frame to frame
+    // The raw frame is kept in frame until the projection overwrites it with the output
+    // The lane filter and the curve fit run on the raw frame scaled down to the processing resolution, if it's lower than the video's
+    const Mat& rawFrame = frame;
+    Size frameSize = GetFrameSize(rawFrame);
+
+    // YUV frames are filtered straight from their luma and chroma and only converted to BGR for the output and the debug views
+    // Filtering in sky view or at a reduced resolution resamples the color frame, so those convert it first
+    bool isYuv = GetFrameFormat(rawFrame) != FrameFormat::BGR;
+    bool filterYuv = isYuv && !filterInSkyView && frameSize == viewTransform.frameSize;
+    bool colorConverted = !isYuv;
+    const Mat& colorFrame = isYuv ? context.colorFrame : rawFrame;
+
+    auto convertColor = [&]()
+    {
+        if (!colorConverted)
+            ConvertFrameToBGR(rawFrame, context.colorFrame);
+
+        colorConverted = true;
+    };
+
+    const Mat& processingFrame = frameSize == viewTransform.frameSize ? colorFrame : context.scaledFrame;
+    const LaneGeometry& geometry = context.geometry;
+    Mat& undistorted = context.undistorted;
+    DebugTaps& debugTaps = context.debugTaps;
+
+    debugTaps.BeginFrame();
+
+    // Frames the scheduler marked for extrapolation skip everything up to the curve fit, once the tracker has two fits to go on
+    bool extrapolate = context.extrapolateLanes && context.laneTracker.CanExtrapolate();
+    frameRecord.lanesExtrapolated = extrapolate;
 
     // Undistort the frame using the calibration data
+    // Only the output frame uses it, the lane filter works on the raw frame or the remapped sky view
     //undistort(frame.clone(), frame, calibrationData.camMatrix, calibrationData.distortion);
-    Mat undistorted;
-    RemapFrame(frame, undistorted, calibrationData, undistortMapData);
-    frame = undistorted;
+    if (context.renderOutput)
+    {
+        convertColor();
+        RemapFrame(colorFrame, undistorted, calibrationData, undistortMapData);
+    }
     // Below function is meant to be used as a faster replacement to undistort, but it doesn't have the same output
     //remap(frame.clone(), frame, undistortMapData.map1, undistortMapData.map2, INTER_LINEAR, BORDER_CONSTANT);
 
-    timer.stop();
-    frameData.undistortTime.push_back(timer.getTimeSec());
+    frameRecord.undistortTime = timer.Stop();
 
-    timer.reset();
-    timer.start();
+    timer.Start("Sky View");
 
-    // Define the points which will be used to warp the perspective
-    // Points from the car towards the horizon, aligned with a centered lane
-    vector<Point2f> sourcePoints({ {580, 460}, {205, 720}, {1110, 720}, {703, 460} });
-    vector<Point2f> destinationPoints({ {320, 0}, {320, 720}, {960, 720}, {960, 0} });
+    // Get the frame the lane filter samples ready, the sky view itself is remapped stripe by stripe inside the lane filter
+    // and otherwise only rendered for the debug views
+    if (!extrapolate && !filterYuv)
+        convertColor();
 
-    Mat skyView;
-    SkyView(frame, skyView, sourcePoints, destinationPoints);
+    if (!extrapolate && frameSize != viewTransform.frameSize)
+        resize(colorFrame, context.scaledFrame, viewTransform.frameSize, 0, 0, INTER_AREA);
 
-    if (showStepsInNewWindows)
-        imshow("Sky View", skyView);
+    frameRecord.skyViewTime = timer.Stop();
 
-    timer.stop();
-    frameData.skyViewTime.push_back(timer.getTimeSec());
+    debugTaps.Tap("Sky View", viewTransform.viewSize, [&](Mat& out, Size size)
+    {
+        convertColor();
 
-    timer.reset();
-    timer.start();
+        if (size == viewTransform.viewSize)
+            ViewTransformFrame(processingFrame, out, viewTransform);
+        else
+        {
+            // Every entry of the remap table is a complete sample position, so a nearest neighbour resize of the table samples the smaller view directly
+            if (context.tapMap1.size() != size)
+            {
+                resize(viewTransform.map1, context.tapMap1, size, 0, 0, INTER_NEAREST);
+                resize(viewTransform.map2, context.tapMap2, size, 0, 0, INTER_NEAREST);
+            }
+
+            remap(processingFrame, out, context.tapMap1, context.tapMap2, INTER_LINEAR, BORDER_CONSTANT);
+        }
+    });
+
+    timer.Start("Lane Filter");
 
     // Filter out the lane using a color mask and sobel mask on the saturation and lightness of the image
     LaneFilterArgs laneFilterArgs(220, 40, 205, Point2f(0.7f, 1.4f), 40, 20);
 
-    LaneFilterData laneFilterData;
-    LaneFilter(frame, laneFilterData, laneFilterArgs);
-    SkyView(laneFilterData.combinedMask, laneFilterData.combinedMask, sourcePoints, destinationPoints);
+    LaneFilterData& laneFilterData = context.laneFilterData;
+    Mat& binary = context.binary;
 
-    Mat binary;
-    threshold(laneFilterData.combinedMask, binary, 150, 1, THRESH_BINARY);
+    // The mask index is banded by the height of the sliding windows
+    int bandRows = viewTransform.frameSize.height / geometry.numWindows;
 
-    // Remove unnecessary edge points
-    rectangle(laneFilterData.combinedMask, Point(0, 0), Point(125, laneFilterData.combinedMask.rows), Scalar(0, 0, 0), -1);
-    rectangle(laneFilterData.combinedMask, Point(laneFilterData.combinedMask.cols, 0), Point(1200, laneFilterData.combinedMask.rows), Scalar(0, 0, 0), -1);
+    // Extrapolated frames keep the mask of the last filtered frame
+    if (!extrapolate && filterInSkyView)
+    {
+        // Filter the sky view directly, the mask is already binary and only covers the road area in viewRect
+        // Place it back into the full sky view plane for the curve fit, anything outside of viewRect is an edge point anyway
+        LaneFilterRemapped(processingFrame, viewTransform.map1, viewTransform.map2, laneFilterData, laneFilterArgs);
 
-    if (showStepsInNewWindows)
+        BinarizeLaneMask(laneFilterData.combinedMask, binary, viewTransform.frameSize, viewTransform.viewRect.tl(), 0, Range(0, viewTransform.frameSize.width),
+            bandRows, context.maskIndex);
+    }
+    else if (!extrapolate)
     {
-        imshow("Color Threshold", laneFilterData.colorMask);
-        imshow("Sobel Threshold", laneFilterData.sobelMask);
-        imshow("Lane Filter", binary * 255);
+        if (filterYuv)
+            LaneFilterYuv(rawFrame, laneFilterData, laneFilterArgs);
+        else
+            LaneFilterFused(processingFrame, laneFilterData, laneFilterArgs);
+
+        TRACE_SCOPE("Mask Sky View");
+        ViewTransformFrame(laneFilterData.combinedMask, context.skyViewMask, viewTransform);
+
+        // Binarize without the unnecessary edge points, the mask is indexed on the way
+        BinarizeLaneMask(context.skyViewMask, binary, viewTransform.frameSize, Point(0, 0), 150, Range(geometry.edgeLeft, geometry.edgeRight), bandRows, context.maskIndex);
     }
 
-    timer.stop();
-    frameData.laneFilterTime.push_back(timer.getTimeSec());
+    frameRecord.laneFilterTime = timer.Stop();
+
+    debugTaps.Tap("Color Threshold", laneFilterData.colorMask.size(), [&](Mat& out, Size size) { RenderMask(laneFilterData.colorMask, out, size, 1); });
+    debugTaps.Tap("Sobel Threshold", laneFilterData.sobelMask.size(), [&](Mat& out, Size size) { RenderMask(laneFilterData.sobelMask, out, size, 1); });
+    debugTaps.Tap("Lane Filter", binary.size(), [&](Mat& out, Size size) { RenderMask(binary, out, size, 255); });
 
-    timer.reset();
-    timer.start();
+    timer.Start("Curve Fit");
 
     // Fit a curve to the lane points from the lane filtering
-    CurveFitData curveData;
-    double metersPerPixelX = 3.7 / 700;
-    double metersPerPixelY = 30.0 / 720;
+    CurveFitData& curveData = context.curveData;
+    double metersPerPixelX = geometry.metersPerPixelX;
+    double metersPerPixelY = geometry.metersPerPixelY;
 
-    CurveFit(binary, curveData, metersPerPixelX, metersPerPixelY, 9, 200, 10);
+    // Search around the previous frame's curves while the lanes are tracked, with the sliding windows as a fallback
+    LaneTrackerArgs laneTrackerArgs(geometry.searchMargin, geometry.minLanePixels, 0.5f, 0.25f, 15);
 
-    if (showStepsInNewWindows)
-        imshow("Curve Fitting", curveData.image);
+    if (extrapolate)
+        ExtrapolateLanes(binary, curveData, context.laneTracker, metersPerPixelX, metersPerPixelY);
+    else
+        TrackLanes(binary, context.maskIndex, curveData, context.laneTracker, laneTrackerArgs, metersPerPixelX, metersPerPixelY, geometry.numWindows, geometry.windowWidth,
+            geometry.minWindowPixels);
 
-    timer.stop();
+    frameRecord.curveFitTime = timer.Stop();
 
-    frameData.leftRadius.push_back(curveData.leftRadius);
-    frameData.rightRadius.push_back(curveData.rightRadius);
-    frameData.vehiclePosition.push_back(curveData.vehiclePosition);
-    frameData.curveFitTime.push_back(timer.getTimeSec());
+    frameRecord.leftRadius = curveData.leftRadius;
+    frameRecord.rightRadius = curveData.rightRadius;
+    frameRecord.vehiclePosition = curveData.vehiclePosition;
 
-    timer.reset();
-    timer.start();
+    // The radii and the position are in meters already, the coefficients are scaled up to the sky view at the video resolution
+    double scaleX = (double)frameSize.width / binary.cols, scaleY = (double)frameSize.height / binary.rows;
 
-    // Fill in the lane pixels and undo the sky view perspective warp
-    Mat projected;
-    ProjectLane(frame, projected, destinationPoints, sourcePoints, curveData);
+    for (int i = 0; i < 3 && curveData.leftPixelK.total() == 3; i++)
+        frameRecord.leftK[i] = (float)(curveData.leftPixelK.at<float>(i) * scaleX / pow(scaleY, i));
 
-    if (showStepsInNewWindows)
-        imshow("Lane Projection", projected);
+    for (int i = 0; i < 3 && curveData.rightPixelK.total() == 3; i++)
+        frameRecord.rightK[i] = (float)(curveData.rightPixelK.at<float>(i) * scaleX / pow(scaleY, i));
 
-    frame = projected;
+    // Hand the lane results to the downstream consumers before anything is drawn
+    if (context.resultPublisher != nullptr)
+    {
+        LaneResult laneResult = {};
+        laneResult.frameIndex = (uint64_t)frameRecord.frameIndex;
+        laneResult.captureTime = LaneResultClock(context.decodeTime);
+        laneResult.publishTime = LaneResultClockNow();
+        copy(begin(frameRecord.leftK), end(frameRecord.leftK), laneResult.leftK);
+        copy(begin(frameRecord.rightK), end(frameRecord.rightK), laneResult.rightK);
+        laneResult.leftRadius = frameRecord.leftRadius;
+        laneResult.rightRadius = frameRecord.rightRadius;
+        laneResult.vehiclePosition = frameRecord.vehiclePosition;
+        laneResult.processingLevel = frameRecord.processingLevel;
+        laneResult.flags = extrapolate ? LaneResultExtrapolated : 0;
+        laneResult.streamIndex = context.streamIndex;
+
+        context.resultPublisher->Publish(laneResult);
+    }
+
+    debugTaps.Tap("Curve Fitting", binary.size(), [&](Mat& out, Size size) { DrawCurveFit(binary, curveData, out, size); });
 
-    timer.stop();
-    frameData.projectionTime.push_back(timer.getTimeSec());
+    // Without anyone looking at the output frame there is nothing left to draw
+    if (!context.renderOutput)
+        return;
 
-    timer.reset();
-    timer.start();
+    timer.Start("Projection");
+
+    // The raw frame isn't needed anymore, so the undistorted frame becomes the output by trading buffers with it instead of being copied
+    // The next frame is then remapped into the raw frame's buffer, which is only safe while nobody else holds either of them, such as an output still queued for writing
+    // A YUV frame doesn't fit the BGR buffer, it is replaced by a copy of the undistorted frame
+    bool tradeBuffers = undistorted.size() == frame.size() && undistorted.type() == frame.type() && OwnsWholeBuffer(frame) && OwnsWholeBuffer(undistorted);
+
+    if (tradeBuffers)
+        swap(frame, undistorted);
+
+    // Fill in the lane pixels and undo the sky view perspective warp
+    // The outline goes from the processing sky view straight to the video resolution
+    ProjectLane(tradeBuffers ? frame : undistorted, frame, viewTransform.outputInverseWarpMatrix, binary.cols, curveData, context.projectionData);
+
+    frameRecord.projectionTime = timer.Stop();
+
+    debugTaps.Tap("Lane Projection", frame.size(), [&](Mat& out, Size size) { resize(frame, out, size); });
+
+    timer.Start("Combine");
 
     // Add the results to the frame
     string posText = "Vehicle Position: " +
@@ -107,52 +251,48 @@ void ProcessFrame(Mat& frame, const CalibrationData& calibrationData, const Part
     string leftRadiusText = "Left Radius: " + to_string(curveData.leftRadius);
     string rightRadiusText = "Right Radius: " + to_string(curveData.rightRadius);
 
+    // The text is laid out for 720 rows and scaled with the frame
+    double textScale = context.outputGeometry.textScale;
+    double fontScale = 0.75 * textScale;
+    int thickness = max(1, (int)lround(2 * textScale));
+    int textLeft = (int)lround(15 * textScale), textRight = frame.cols - (int)lround(400 * textScale);
+    int lineHeight = (int)lround(20 * textScale);
+
     if (combineStepsInFinalFrame)
     {
-        // Resize the individual frames to 1/5 their size
-        int viewWidth = frame.cols / 5.0;
-        int viewHeight = frame.rows / 5.0;
-
-        resize(skyView, skyView, Size(), 0.2, 0.2);
-        resize(laneFilterData.colorMask, laneFilterData.colorMask, Size(), 0.2, 0.2);
-        resize(laneFilterData.sobelMask, laneFilterData.sobelMask, Size(), 0.2, 0.2);
-        resize(binary, binary, Size(), 0.2, 0.2);
-        resize(curveData.image, curveData.image, Size(), 0.2, 0.2);
-
-        binary *= 255; // Needs to be multiplied to be visible
-
-        // Convert from CV_8U to CV_8UC3
-        cvtColor(laneFilterData.colorMask, laneFilterData.colorMask, COLOR_GRAY2BGR);
-        cvtColor(laneFilterData.sobelMask, laneFilterData.sobelMask, COLOR_GRAY2BGR);
-        cvtColor(binary, binary, COLOR_GRAY2BGR);
-
-        // Copy the frames to the top of the final frame
-        skyView.copyTo(frame(Rect(0, 0, viewWidth, viewHeight)));
-        laneFilterData.colorMask.copyTo(frame(Rect(viewWidth, 0, viewWidth, viewHeight)));
-        laneFilterData.sobelMask.copyTo(frame(Rect(viewWidth * 2, 0, viewWidth, viewHeight)));
-        binary.copyTo(frame(Rect(viewWidth * 3, 0, viewWidth, viewHeight)));
-        curveData.image.copyTo(frame(Rect(viewWidth * 4, 0, viewWidth, viewHeight)));
-
-        // Draw rectangles around the frames to show their borders
-        rectangle(frame, Rect(0, 0, viewWidth, viewHeight), Scalar_(0, 0, 255));
-        rectangle(frame, Rect(viewWidth, 0, viewWidth, viewHeight), Scalar_(0, 0, 255));
-        rectangle(frame, Rect(viewWidth * 2, 0, viewWidth, viewHeight), Scalar_(0, 0, 255));
-        rectangle(frame, Rect(viewWidth * 3, 0, viewWidth, viewHeight), Scalar_(0, 0, 255));
-        rectangle(frame, Rect(viewWidth * 4, 0, viewWidth, viewHeight), Scalar_(0, 0, 255));
+        // The views were rendered at 1/5 of the frame size by the debug taps
+        int viewWidth = frame.cols / 5;
+        int viewHeight = frame.rows / 5;
+        Size viewSize(viewWidth, viewHeight);
+
+        for (int i = 0; i < 5; i++)
+        {
+            Rect viewRect(viewWidth * i, 0, viewWidth, viewHeight);
+            Mat framePart = frame(viewRect);
+            const Mat* view = debugTaps.Find(MontageViews[i], viewSize);
+
+            // Convert the masks from CV_8U to CV_8UC3
+            if (view != nullptr && view->channels() == 1)
+                cvtColor(*view, framePart, COLOR_GRAY2BGR);
+            else if (view != nullptr)
+                view->copyTo(framePart);
+
+            // Draw rectangles around the frames to show their borders
+            rectangle(frame, viewRect, Scalar_(0, 0, 255));
+        }
 
         // Draw the lane data as text
-        putText(frame, posText, Point(15, viewHeight + 20), FONT_HERSHEY_DUPLEX, 0.75, Scalar(0, 0, 0), 2, FILLED);
-        putText(frame, leftRadiusText, Point(frame.cols - 400, viewHeight + 20), FONT_HERSHEY_DUPLEX, 0.75, Scalar(0, 0, 0), 2, FILLED);
-        putText(frame, rightRadiusText, Point(frame.cols - 400, viewHeight + 40), FONT_HERSHEY_DUPLEX, 0.75, Scalar(0, 0, 0), 2, FILLED);
+        putText(frame, posText, Point(textLeft, viewHeight + lineHeight), FONT_HERSHEY_DUPLEX, fontScale, Scalar(0, 0, 0), thickness, FILLED);
+        putText(frame, leftRadiusText, Point(textRight, viewHeight + lineHeight), FONT_HERSHEY_DUPLEX, fontScale, Scalar(0, 0, 0), thickness, FILLED);
+        putText(frame, rightRadiusText, Point(textRight, viewHeight + lineHeight * 2), FONT_HERSHEY_DUPLEX, fontScale, Scalar(0, 0, 0), thickness, FILLED);
     }
     else
     {
         // Draw the lane data as text
-        putText(frame, posText, Point(15, 20), FONT_HERSHEY_DUPLEX, 0.75, Scalar(0, 0, 0), 2, FILLED);
-        putText(frame, leftRadiusText, Point(frame.cols - 400, 20), FONT_HERSHEY_DUPLEX, 0.75, Scalar(0, 0, 0), 2, FILLED);
-        putText(frame, rightRadiusText, Point(frame.cols - 400, 40), FONT_HERSHEY_DUPLEX, 0.75, Scalar(0, 0, 0), 2, FILLED);
+        putText(frame, posText, Point(textLeft, lineHeight), FONT_HERSHEY_DUPLEX, fontScale, Scalar(0, 0, 0), thickness, FILLED);
+        putText(frame, leftRadiusText, Point(textRight, lineHeight), FONT_HERSHEY_DUPLEX, fontScale, Scalar(0, 0, 0), thickness, FILLED);
+        putText(frame, rightRadiusText, Point(textRight, lineHeight * 2), FONT_HERSHEY_DUPLEX, fontScale, Scalar(0, 0, 0), thickness, FILLED);
     }
 
-    timer.stop();
-    frameData.combineTime.push_back(timer.getTimeSec());
-}
\ No newline at end of file
+    frameRecord.combineTime = timer.Stop();
+}
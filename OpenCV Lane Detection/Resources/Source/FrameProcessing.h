@@ -1,9 +1,14 @@
 #pragma once
 
 #include "Undistortion.h"
+#include "ViewTransform.h"
 #include "LaneFilter.h"
 #include "SkyView.h"
 #include "Curves.h"
+#include "PipelineContext.h"
+#include "FrameData.h"
+#include "FrameSource.h"
+#include "Trace.h"
 
 #include <iostream>
 #include <filesystem>
@@ -13,57 +18,9 @@ using namespace std;
 using namespace cv;
 using namespace filesystem;
 
-struct FrameData
-{
-public:
-	vector<double> undistortTime, skyViewTime, 
-		laneFilterTime, curveFitTime, 
-		projectionTime, combineTime,
-		leftRadius, rightRadius,
-		vehiclePosition;
+// Subscribes the step views of -n at their native size and the montage views of -m at 1/5 of the frame size
+void SubscribeDebugViews(DebugTaps& debugTaps, Size frameSize, bool showStepsInNewWindows, bool combineStepsInFinalFrame);
+// Shows every native size view rendered this frame in its own window, has to run on the thread driving HighGUI
+void ShowDebugViews(const DebugTaps& debugTaps);
 
-	void OutputMostRecentToConsole()
-	{
-		cout << "Undistort Time: " << undistortTime.back() << endl <<
-			"Sky View Time: " << skyViewTime.back() << endl <<
-			"Lane Filter Time: " << laneFilterTime.back() << endl <<
-			"Curve Fit Time: " << curveFitTime.back() << endl <<
-			"Projection Time: " << projectionTime.back() << endl <<
-			"Combine Time: " << combineTime.back() << endl << endl;
-	}
-
-	void OutputToFile(const string path)
-	{
-		Mat undistortTimeMat(undistortTime),
-			skyViewTimeMat(skyViewTime),
-			laneFilterTimeMat(laneFilterTime),
-			curveFitTimeMat(curveFitTime),
-			projectionTimeMat(projectionTime),
-			combineTimeMat(combineTime),
-			leftRadiusMat(leftRadius),
-			rightRadiusMat(rightRadius),
-			vehiclePositionMat(vehiclePosition);
-
-		if (!exists(path))
-			create_directory(path);
-
-		FileStorage outStream(path + "\\frame_data.yml", FileStorage::WRITE);
-
-		if (!outStream.isOpened())
-			return;
-
-		outStream << "Undistort Time" << undistortTimeMat <<
-			"Sky View Time" << skyViewTimeMat <<
-			"Lane Filter Time" << laneFilterTimeMat <<
-			"Curve Fit Time" << curveFitTimeMat <<
-			"Projection Time" << projectionTimeMat <<
-			"Combine Time" << combineTimeMat <<
-			"Left Curve Radius" << leftRadiusMat <<
-			"Right Curve Radius" << rightRadiusMat <<
-			"Vehicle Position" << vehiclePositionMat;
-
-		outStream.release();
-	}
-};
-
-void ProcessFrame(Mat& frame, const CalibrationData& calibrationData, const PartUndistortMapData& undistortMapData, FrameData& frameData, bool showStepsInNewWindows, bool combineStepsInFinalFrame);
\ No newline at end of file
+void ProcessFrame(Mat& frame, const CalibrationData& calibrationData, const PartUndistortMapData& undistortMapData, const ViewTransformData& viewTransform, PipelineContext& context, FrameRecord& frameRecord, bool combineStepsInFinalFrame, bool filterInSkyView = false);
\ No newline at end of file
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <algorithm>
+
+using namespace std;
+
+// Bounded lock-free queue between exactly one producer thread and one consumer thread
+// Push() never blocks, when the queue is full the oldest item is dropped to make room for the new one
+// TryPush() refuses the new item instead, so the producer can wait for room
+// The items live in slots allocated once up front, so pushing and popping never allocate
+template <typename T>
+class FrameQueue
+{
+public:
+	FrameQueue(size_t capacity) :
+		capacity(max<size_t>(capacity, 1)),
+		slotCount(max<size_t>(capacity, 1) + 1),
+		slots(new Slot[max<size_t>(capacity, 1) + 1]),
+		head(0), tail(0), droppedCount(0)
+	{
+		for (size_t i = 0; i < slotCount; i++)
+			slots[i].sequence.store(i, memory_order_relaxed);
+	}
+
+	FrameQueue(const FrameQueue&) = delete;
+	FrameQueue& operator=(const FrameQueue&) = delete;
+
+	// Producer side
+	void Push(T item)
+	{
+		T dropped;
+
+		while (!TryPush(item))
+		{
+			// Full of waiting items, drop the oldest one the same way the consumer would take it
+			// Otherwise the consumer is still moving an item out of the slot the new one goes into, which only takes a moment
+			if (Take(dropped, true))
+				droppedCount.fetch_add(1, memory_order_relaxed);
+			else
+				this_thread::yield();
+		}
+	}
+
+	// Producer side, for streams that must not lose frames
+	// Returns false and leaves the item untouched when the queue is full
+	bool TryPush(T& item)
+	{
+		size_t t = tail.load(memory_order_relaxed);
+		Slot& slot = slots[t % slotCount];
+
+		if (t - head.load(memory_order_acquire) >= capacity)
+			return false;
+
+		// The consumer is still moving the item of the previous lap out of the slot
+		if (slot.sequence.load(memory_order_acquire) != t)
+			return false;
+
+		slot.item = std::move(item);
+		slot.sequence.store(t + 1, memory_order_release);
+		tail.store(t + 1, memory_order_release);
+
+		return true;
+	}
+
+	// Consumer side, returns false if the queue is empty
+	bool Pop(T& item)
+	{
+		return Take(item, false);
+	}
+
+	size_t Size() const
+	{
+		size_t h = head.load(memory_order_acquire);
+		return tail.load(memory_order_acquire) - h;
+	}
+
+	size_t DroppedCount() const
+	{
+		return droppedCount.load(memory_order_relaxed);
+	}
+
+private:
+	// Item n goes into slot n % slotCount, the slot's sequence says whose turn it is:
+	// n while the slot is free for the producer, n + 1 once the item is in it and n + slotCount once it has been taken out again
+	// There is one more slot than the capacity, so the producer only waits for the slot when the consumer stalls in the middle of taking an item
+	struct Slot
+	{
+		atomic<size_t> sequence;
+		T item;
+	};
+
+	// Both the consumer and a producer dropping the oldest item take from the head, whoever claims it first moves the item out
+	// The other one moves on to the next item, so nobody can end up with an item that was already taken or with a newer one
+	bool Take(T& item, bool onlyWhenFull)
+	{
+		for (;;)
+		{
+			size_t h = head.load(memory_order_relaxed);
+			Slot& slot = slots[h % slotCount];
+			ptrdiff_t ready = (ptrdiff_t)(slot.sequence.load(memory_order_acquire) - (h + 1));
+
+			// Nothing written into the head slot yet
+			if (ready < 0)
+				return false;
+
+			// Taken by the other side since head was read
+			if (ready > 0)
+				continue;
+
+			if (onlyWhenFull && tail.load(memory_order_acquire) - h < capacity)
+				return false;
+
+			if (head.compare_exchange_weak(h, h + 1, memory_order_relaxed))
+			{
+				item = std::move(slot.item);
+				slot.sequence.store(h + slotCount, memory_order_release);
+
+				return true;
+			}
+		}
+	}
+
+	const size_t capacity, slotCount;
+	unique_ptr<Slot[]> slots;
+
+	alignas(64) atomic<size_t> head;
+	alignas(64) atomic<size_t> tail;
+	atomic<size_t> droppedCount;
+};
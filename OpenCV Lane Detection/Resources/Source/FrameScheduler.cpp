@@ -0,0 +1,72 @@
+#include "FrameScheduler.h"
+
+PipelineContext& ScheduledContext::Select(bool reducedResolution)
+{
+    if (reducedResolution != reducedActive)
+    {
+        PipelineContext& from = Active();
+        PipelineContext& to = reducedResolution ? reduced : full;
+
+        TransferLaneTracker(from.laneTracker, to.laneTracker,
+            (double)to.frameSize.width / from.frameSize.width, (double)to.frameSize.height / from.frameSize.height);
+
+        reducedActive = reducedResolution;
+    }
+
+    return Active();
+}
+
+FrameScheduler::FrameScheduler(double budgetSeconds) : budget(budgetSeconds)
+{
+}
+
+void FrameScheduler::RunFrame(Mat& frame, chrono::steady_clock::time_point decodeTime, const CalibrationData& calibrationData, const PartUndistortMapData& undistortMapData,
+    const ViewTransformData& viewTransform, const ViewTransformData& reducedViewTransform, ScheduledContext& context, FrameRecord& frameRecord,
+    bool combineStepsInFinalFrame, bool filterInSkyView)
+{
+    ProcessingLevel currentLevel = Level();
+    bool reducedResolution = currentLevel >= ProcessingLevel::ReducedResolution;
+    PipelineContext& pipelineContext = context.Select(reducedResolution);
+
+    // Alternate over the frames of this context, so every thread keeps fitting every other one of its frames
+    pipelineContext.debugTaps.paused = currentLevel >= ProcessingLevel::NoDebugViews;
+    pipelineContext.extrapolateLanes = currentLevel >= ProcessingLevel::AlternateFrames && context.frameCount % 2 == 1;
+    context.frameCount++;
+
+    pipelineContext.decodeTime = decodeTime;
+    frameRecord.processingLevel = (int)currentLevel;
+
+    ProcessFrame(frame, calibrationData, undistortMapData, reducedResolution ? reducedViewTransform : viewTransform, pipelineContext, frameRecord,
+        combineStepsInFinalFrame, filterInSkyView);
+
+    frameRecord.latency = chrono::duration<double>(chrono::steady_clock::now() - decodeTime).count();
+
+    Report(frameRecord.latency);
+}
+
+void FrameScheduler::Report(double latencySeconds)
+{
+    if (budget <= 0)
+        return;
+
+    lock_guard<mutex> guard(lock);
+
+    averageLatency = averageLatency == 0 ? latencySeconds : averageLatency + 0.2 * (latencySeconds - averageLatency);
+    framesSinceChange++;
+    framesUnderBudget = averageLatency < budget * 0.5 ? framesUnderBudget + 1 : 0;
+
+    int current = (int)level.load(memory_order_relaxed);
+
+    if (averageLatency > budget && framesSinceChange >= SettleFrames && current + 1 < (int)ProcessingLevel::Count)
+    {
+        level.store((ProcessingLevel)(current + 1), memory_order_relaxed);
+        framesSinceChange = 0;
+        framesUnderBudget = 0;
+    }
+    else if (framesUnderBudget >= RecoverFrames && current > 0)
+    {
+        level.store((ProcessingLevel)(current - 1), memory_order_relaxed);
+        framesSinceChange = 0;
+        framesUnderBudget = 0;
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "FrameProcessing.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <opencv2/core.hpp>
+
+using namespace std;
+using namespace cv;
+
+// Steps the scheduler degrades the processing in while frames are over the latency budget, each one keeps the ones before it
+enum class ProcessingLevel
+{
+    Full,
+    NoDebugViews, // The debug views and the montage aren't rendered
+    ReducedResolution, // The lane filter and the curve fit run at half of the processing resolution
+    AlternateFrames, // Every other frame skips the lane filter and extrapolates the lanes from their recent motion
+    Count
+};
+
+// The pipeline state of one processing thread under the scheduler, at the processing resolution and at the reduced one
+// The lane tracker moves along whenever the resolution changes, so switching doesn't lose the lanes
+struct ScheduledContext
+{
+    PipelineContext full, reduced;
+    bool reducedActive = false;
+    int64 frameCount = 0;
+
+    void Allocate(const ViewTransformData& viewTransform, const ViewTransformData& reducedViewTransform, bool filterInSkyView)
+    {
+        full.Allocate(viewTransform, filterInSkyView);
+        reduced.Allocate(reducedViewTransform, filterInSkyView);
+    }
+
+    PipelineContext& Active()
+    {
+        return reducedActive ? reduced : full;
+    }
+
+    PipelineContext& Select(bool reducedResolution);
+};
+
+// Keeps the time from decoding a frame to the end of its processing within a budget
+// The latency is smoothed over the recent frames, the level goes up a step when it stays over the budget and back down once it's well under it
+// A budget of zero turns the scheduler off, every frame is then processed in full
+class FrameScheduler
+{
+public:
+    FrameScheduler(double budgetSeconds);
+
+    ProcessingLevel Level() const { return level.load(memory_order_relaxed); }
+
+    // Processes a frame at the current level and feeds its latency back, the decision and the latency go into the frame record
+    void RunFrame(Mat& frame, chrono::steady_clock::time_point decodeTime, const CalibrationData& calibrationData, const PartUndistortMapData& undistortMapData,
+        const ViewTransformData& viewTransform, const ViewTransformData& reducedViewTransform, ScheduledContext& context, FrameRecord& frameRecord,
+        bool combineStepsInFinalFrame, bool filterInSkyView);
+
+    void Report(double latencySeconds);
+
+private:
+    // Frames to wait after a change before going up another step, until the frames queued before it have drained
+    static constexpr int SettleFrames = 8;
+    // Frames under half of the budget before going back down a step
+    static constexpr int RecoverFrames = 60;
+
+    double budget;
+    atomic<ProcessingLevel> level = ProcessingLevel::Full;
+
+    mutex lock;
+    double averageLatency = 0;
+    int framesSinceChange = 0, framesUnderBudget = 0;
+};
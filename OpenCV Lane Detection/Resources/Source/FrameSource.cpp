@@ -0,0 +1,173 @@
+#include "FrameSource.h"
+
+#include <filesystem>
+#include <iostream>
+#include <opencv2/imgproc.hpp>
+
+FrameFormat GetFrameFormat(const Mat& frame)
+{
+    if (frame.type() == CV_8UC2)
+        return FrameFormat::YUYV;
+
+    if (frame.type() == CV_8UC1)
+        return FrameFormat::NV12;
+
+    return FrameFormat::BGR;
+}
+
+Size GetFrameSize(const Mat& frame)
+{
+    if (GetFrameFormat(frame) == FrameFormat::NV12)
+        return Size(frame.cols, frame.rows * 2 / 3);
+
+    return frame.size();
+}
+
+void ConvertFrameToBGR(const Mat& frame, Mat& out)
+{
+    switch (GetFrameFormat(frame))
+    {
+    case FrameFormat::NV12:
+        cvtColor(frame, out, COLOR_YUV2BGR_NV12);
+        break;
+    case FrameFormat::YUYV:
+        cvtColor(frame, out, COLOR_YUV2BGR_YUYV);
+        break;
+    default:
+        frame.copyTo(out);
+        break;
+    }
+}
+
+void ConvertBGRToNV12(const Mat& frame, Mat& out)
+{
+    CV_Assert(frame.type() == CV_8UC3 && frame.cols % 2 == 0 && frame.rows % 2 == 0);
+
+    // cvtColor only goes to planar I420, the U and V planes are interleaved into the UV rows of NV12
+    Mat i420;
+    cvtColor(frame, i420, COLOR_BGR2YUV_I420);
+
+    int width = frame.cols, height = frame.rows;
+    int chromaWidth = width / 2, chromaSize = chromaWidth * (height / 2);
+
+    out.create(height * 3 / 2, width, CV_8UC1);
+    i420.rowRange(0, height).copyTo(out.rowRange(0, height));
+
+    const uchar* u = i420.ptr<uchar>(height);
+    const uchar* v = u + chromaSize;
+
+    for (int y = 0; y < height / 2; y++)
+    {
+        uchar* rowPtr = out.ptr<uchar>(height + y);
+
+        for (int x = 0; x < chromaWidth; x++)
+        {
+            rowPtr[x * 2] = u[y * chromaWidth + x];
+            rowPtr[x * 2 + 1] = v[y * chromaWidth + x];
+        }
+    }
+}
+
+// Mat layout of one frame of the format
+static void CreateFrame(Mat& frame, Size frameSize, FrameFormat format)
+{
+    if (format == FrameFormat::NV12)
+        frame.create(frameSize.height * 3 / 2, frameSize.width, CV_8UC1);
+    else if (format == FrameFormat::YUYV)
+        frame.create(frameSize, CV_8UC2);
+    else
+        frame.create(frameSize, CV_8UC3);
+}
+
+bool FrameSource::Open(const string path, FrameFormat format, Size rawSize, double rawFps)
+{
+    string extension = filesystem::path(path).extension().string();
+
+    isRawFile = extension == ".nv12" || extension == ".yuyv" || extension == ".yuv";
+
+    if (isRawFile)
+    {
+        this->format = extension == ".yuyv" ? FrameFormat::YUYV : extension == ".nv12" || format == FrameFormat::BGR ? FrameFormat::NV12 : format;
+        frameSize = rawSize;
+        fps = rawFps;
+
+        if (frameSize.empty() || frameSize.width % 2 != 0 || frameSize.height % 2 != 0)
+        {
+            cerr << "Raw YUV files need an even frame size" << endl;
+            return false;
+        }
+
+        rawFile.open(path, ios::binary);
+        return rawFile.is_open();
+    }
+
+    if (!video.open(path))
+        return false;
+
+    this->format = format;
+    frameSize = Size((int)video.get(CAP_PROP_FRAME_WIDTH), (int)video.get(CAP_PROP_FRAME_HEIGHT));
+    fps = video.get(CAP_PROP_FPS);
+
+    // Cameras are asked for the format too, files keep their codec and only skip the conversion
+    if (format != FrameFormat::BGR)
+    {
+        video.set(CAP_PROP_FOURCC, format == FrameFormat::NV12 ? VideoWriter::fourcc('N', 'V', '1', '2') : VideoWriter::fourcc('Y', 'U', 'Y', 'V'));
+        video.set(CAP_PROP_CONVERT_RGB, 0);
+    }
+
+    return true;
+}
+
+bool FrameSource::Read(Mat& frame)
+{
+    if (isRawFile)
+    {
+        CreateFrame(frame, frameSize, format);
+        size_t frameBytes = frame.total() * frame.elemSize();
+
+        rawFile.read((char*)frame.data, (streamsize)frameBytes);
+        return (size_t)rawFile.gcount() == frameBytes;
+    }
+
+    // Grabbed and retrieved separately, so the frame can be retrieved again after falling back to BGR
+    if (!video.grab() || !video.retrieve(frame))
+        return false;
+
+    // Not every backend honors the conversion setting, anything that isn't a whole frame of the expected layout falls back to BGR
+    if (format != FrameFormat::BGR && (GetFrameFormat(frame) != format || GetFrameSize(frame) != frameSize))
+    {
+        cerr << "The video doesn't deliver whole YUV frames, falling back to BGR" << endl;
+
+        format = FrameFormat::BGR;
+        video.set(CAP_PROP_CONVERT_RGB, 1);
+
+        if (frame.type() == CV_8UC3 && frame.size() == frameSize)
+            return true;
+
+        // A whole frame of the other YUV layout is converted here, anything else is retrieved once more with the conversion on
+        // Either way the grabbed frame is kept, so the frame indices match a run without -f
+        if (GetFrameFormat(frame) != FrameFormat::BGR && GetFrameSize(frame) == frameSize)
+        {
+            Mat yuvFrame = frame;
+            frame = Mat();
+            ConvertFrameToBGR(yuvFrame, frame);
+            return true;
+        }
+
+        return video.retrieve(frame) && frame.type() == CV_8UC3 && frame.size() == frameSize;
+    }
+
+    return true;
+}
+
+void FrameSource::Rewind()
+{
+    if (isRawFile)
+    {
+        rawFile.clear();
+        rawFile.seekg(0);
+        return;
+    }
+
+    video.set(CAP_PROP_POS_FRAMES, 0);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+
+using namespace std;
+using namespace cv;
+
+// Pixel layouts a frame can arrive in, told apart by the Mat type
+// NV12 is a CV_8UC1 Mat with the luma rows followed by height / 2 interleaved UV rows, YUYV is CV_8UC2
+enum class FrameFormat
+{
+    BGR,
+    NV12,
+    YUYV
+};
+
+FrameFormat GetFrameFormat(const Mat& frame);
+// Size in pixels, which isn't the Mat size for NV12
+Size GetFrameSize(const Mat& frame);
+void ConvertFrameToBGR(const Mat& frame, Mat& out);
+// NV12 frame of a BGR one with an even size, as a capture source would deliver it
+void ConvertBGRToNV12(const Mat& frame, Mat& out);
+
+// Decoded frames from a VideoCapture, or raw NV12 / YUYV frames from a file (.nv12, .yuyv or .yuv)
+// Asking a capture for a YUV format turns off its BGR conversion, sources that deliver YUV natively then skip it altogether
+// A capture that delivers some other layout is switched back to BGR
+class FrameSource
+{
+public:
+    // rawSize and rawFps describe raw files, which have no header, a .yuv file is read in the requested format (NV12 by default)
+    bool Open(const string path, FrameFormat format = FrameFormat::BGR, Size rawSize = Size(), double rawFps = 30);
+    bool Read(Mat& frame);
+    void Rewind();
+
+    Size FrameSize() const { return frameSize; }
+    double Fps() const { return fps; }
+
+private:
+    VideoCapture video;
+    ifstream rawFile;
+    bool isRawFile = false;
+
+    FrameFormat format = FrameFormat::BGR;
+    Size frameSize;
+    double fps = 0;
+};
@@ -1,8 +1,12 @@
 #include "LaneFilter.h"
+#include "Stripes.h"
+#include "Trace.h"
 
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 #include <iostream>
+#include <climits>
 
 using namespace std;
 using namespace cv;
@@ -123,4 +127,504 @@ void LaneFilter(const Mat& in, LaneFilterData& out, LaneFilterArgs args)
 	SobelMask(hlsImage, out.sobelMask, args);
 
 	out.combinedMask = out.colorMask | out.sobelMask;
-}
\ No newline at end of file
+}
+
+// Thresholds of LaneFilterArgs in the form used by the fused kernel
+struct FusedThresholds
+{
+	uchar lightness, saturation, lightnessAgr;
+
+	// SobelMask rounds the direction to a whole number of radians (0, 1 or 2) before thresholding it
+	// The class boundaries at 0.5 and 1.5 radians are compared as squared tangents, sobelX^2 > tan^2 * sobelY^2
+	float directionLowTanSq, directionHighTanSq;
+	uchar directionPass[3];
+};
+
+static FusedThresholds GetFusedThresholds(const LaneFilterArgs& args)
+{
+	FusedThresholds thresholds;
+
+	thresholds.lightness = saturate_cast<uchar>(args.lightnessThreshold);
+	thresholds.saturation = saturate_cast<uchar>(args.saturationThreshold);
+	thresholds.lightnessAgr = saturate_cast<uchar>(args.lightnessThresholdAgr);
+
+	thresholds.directionLowTanSq = (float)(tan(0.5) * tan(0.5));
+	thresholds.directionHighTanSq = (float)(tan(1.5) * tan(1.5));
+
+	for (int i = 0; i < 3; i++)
+		thresholds.directionPass[i] = (i > args.directionThreshold.x && !(i > args.directionThreshold.y)) ? 255 : 0;
+
+	return thresholds;
+}
+
+// Splits the lightness (channel 1) and saturation (channel 2) out of one row of the image
+static void SplitLightnessSaturationRow(const uchar* in, uchar* lightness, uchar* saturation, int width)
+{
+	int x = 0;
+#if CV_SIMD
+	for (; x <= width - v_uint8::nlanes; x += v_uint8::nlanes)
+	{
+		v_uint8 c0, c1, c2;
+		v_load_deinterleave(in + x * 3, c0, c1, c2);
+		v_store(lightness + x, c1);
+		v_store(saturation + x, c2);
+	}
+#endif
+	for (; x < width; x++)
+	{
+		lightness[x] = in[x * 3 + 1];
+		saturation[x] = in[x * 3 + 2];
+	}
+}
+
+// YUV frames stand in for the two BGR channels the filter thresholds, using the BT.601 limited range conversion of cvtColor
+// lightness = 1.164 * (Y - 16) is the luma scaled to full range, saturation = lightness + 1.596 * (V - 128) is the red channel
+// In fixed point as (Y - 16) * 149 >> 7 and (V - 128) * 204 >> 7
+static inline void LumaChromaToLightnessSaturation(int luma, int v, uchar& lightness, uchar& saturation)
+{
+	int fullLuma = (std::max(luma - 16, 0) * 149) >> 7;
+
+	lightness = saturate_cast<uchar>(fullLuma);
+	saturation = saturate_cast<uchar>(fullLuma + (((v - 128) * 204) >> 7));
+}
+
+#if CV_SIMD
+// Vector version of the above for one register of pixels, luma and v hold one value per pixel
+static inline void LumaChromaToLightnessSaturation(const v_uint8& luma, const v_uint8& v, uchar* lightness, uchar* saturation)
+{
+	v_uint16 luma16[2], v16[2];
+	v_expand(luma, luma16[0], luma16[1]);
+	v_expand(v, v16[0], v16[1]);
+
+	v_int16 fullLuma[2], red[2];
+	v_uint16 vOffset = vx_setall_u16(16), vLumaScale = vx_setall_u16(149);
+	v_int16 vChromaOffset = vx_setall_s16(128), vChromaScale = vx_setall_s16(204);
+
+	for (int h = 0; h < 2; h++)
+	{
+		// Unsigned saturating subtraction clamps at zero like the scalar max
+		fullLuma[h] = v_reinterpret_as_s16(v_shr<7>((luma16[h] - vOffset) * vLumaScale));
+		red[h] = fullLuma[h] + v_shr<7>((v_reinterpret_as_s16(v16[h]) - vChromaOffset) * vChromaScale);
+	}
+
+	v_store(lightness, v_pack_u(fullLuma[0], fullLuma[1]));
+	v_store(saturation, v_pack_u(red[0], red[1]));
+}
+#endif
+
+// One NV12 row: the luma row and the interleaved UV row shared by two luma rows, each chroma pair covers two pixels
+static void SplitNV12Row(const uchar* luma, const uchar* chroma, uchar* lightness, uchar* saturation, int width)
+{
+	int x = 0;
+#if CV_SIMD
+	for (; x <= width - 2 * v_uint8::nlanes; x += 2 * v_uint8::nlanes)
+	{
+		v_uint8 u, v, vLow, vHigh;
+		v_load_deinterleave(chroma + x, u, v);
+		v_zip(v, v, vLow, vHigh);
+
+		LumaChromaToLightnessSaturation(vx_load(luma + x), vLow, lightness + x, saturation + x);
+		LumaChromaToLightnessSaturation(vx_load(luma + x + v_uint8::nlanes), vHigh, lightness + x + v_uint8::nlanes, saturation + x + v_uint8::nlanes);
+	}
+#endif
+	for (; x < width; x++)
+		LumaChromaToLightnessSaturation(luma[x], chroma[(x & ~1) + 1], lightness[x], saturation[x]);
+}
+
+// One YUYV row, packed as Y0 U Y1 V for every two pixels
+static void SplitYUYVRow(const uchar* in, uchar* lightness, uchar* saturation, int width)
+{
+	int x = 0;
+#if CV_SIMD
+	for (; x <= width - 2 * v_uint8::nlanes; x += 2 * v_uint8::nlanes)
+	{
+		v_uint8 y0, u, y1, v, lumaLow, lumaHigh, vLow, vHigh;
+		v_load_deinterleave(in + x * 2, y0, u, y1, v);
+		v_zip(y0, y1, lumaLow, lumaHigh);
+		v_zip(v, v, vLow, vHigh);
+
+		LumaChromaToLightnessSaturation(lumaLow, vLow, lightness + x, saturation + x);
+		LumaChromaToLightnessSaturation(lumaHigh, vHigh, lightness + x + v_uint8::nlanes, saturation + x + v_uint8::nlanes);
+	}
+#endif
+	for (; x < width; x++)
+		LumaChromaToLightnessSaturation(in[x * 2], in[(x & ~1) * 2 + 3], lightness[x], saturation[x]);
+}
+
+// Vertical part of the separable 5x5 sobel kernels over the 5 lightness rows centered on the output row
+// smooth = [1 4 6 4 1] (used for the x gradient), deriv = [-1 -2 0 2 1] (used for the y gradient)
+static void SobelVerticalRow(const uchar* const rows[5], short* smooth, short* deriv, int width)
+{
+	int x = 0;
+#if CV_SIMD
+	for (; x <= width - v_int16::nlanes; x += v_int16::nlanes)
+	{
+		v_int16 a = v_reinterpret_as_s16(vx_load_expand(rows[0] + x));
+		v_int16 b = v_reinterpret_as_s16(vx_load_expand(rows[1] + x));
+		v_int16 c = v_reinterpret_as_s16(vx_load_expand(rows[2] + x));
+		v_int16 d = v_reinterpret_as_s16(vx_load_expand(rows[3] + x));
+		v_int16 e = v_reinterpret_as_s16(vx_load_expand(rows[4] + x));
+
+		v_store(smooth + x, a + e + ((b + d) << 2) + (c << 2) + (c << 1));
+		v_store(deriv + x, (e - a) + ((d - b) << 1));
+	}
+#endif
+	for (; x < width; x++)
+	{
+		smooth[x] = (short)(rows[0][x] + rows[4][x] + 4 * (rows[1][x] + rows[3][x]) + 6 * rows[2][x]);
+		deriv[x] = (short)(rows[4][x] - rows[0][x] + 2 * (rows[3][x] - rows[1][x]));
+	}
+}
+
+// Horizontal part of the separable 5x5 sobel kernels, outputs the absolute gradients
+// smooth and deriv have two reflected elements before and after the row
+static void SobelHorizontalRow(const short* smooth, const short* deriv, short* gradX, short* gradY, int width)
+{
+	int x = 0;
+#if CV_SIMD
+	for (; x <= width - v_int16::nlanes; x += v_int16::nlanes)
+	{
+		v_int16 s0 = vx_load(smooth + x - 2), s1 = vx_load(smooth + x - 1);
+		v_int16 s3 = vx_load(smooth + x + 1), s4 = vx_load(smooth + x + 2);
+
+		v_int16 d0 = vx_load(deriv + x - 2), d1 = vx_load(deriv + x - 1), d2 = vx_load(deriv + x);
+		v_int16 d3 = vx_load(deriv + x + 1), d4 = vx_load(deriv + x + 2);
+
+		v_int16 gx = (s4 - s0) + ((s3 - s1) << 1);
+		v_int16 gy = d0 + d4 + ((d1 + d3) << 2) + (d2 << 2) + (d2 << 1);
+
+		v_store(gradX + x, v_reinterpret_as_s16(v_abs(gx)));
+		v_store(gradY + x, v_reinterpret_as_s16(v_abs(gy)));
+	}
+#endif
+	for (; x < width; x++)
+	{
+		int gx = smooth[x + 2] - smooth[x - 2] + 2 * (smooth[x + 1] - smooth[x - 1]);
+		int gy = deriv[x - 2] + deriv[x + 2] + 4 * (deriv[x - 1] + deriv[x + 1]) + 6 * deriv[x];
+
+		gradX[x] = (short)std::abs(gx);
+		gradY[x] = (short)std::abs(gy);
+	}
+}
+
+// First sweep over a row: color mask, direction part of the sobel mask and the maxima needed to normalize the sobel mask
+static void ColorDirectionRow(const uchar* lightness, const uchar* saturation, const short* gradX, const short* gradY,
+	uchar* colorMask, uchar* directionMask, const FusedThresholds& thresholds, int width, int& maxMagnitudeSq, int& maxGradX)
+{
+	int x = 0;
+#if CV_SIMD
+	v_uint8 vLightness = vx_setall_u8(thresholds.lightness);
+	v_uint8 vSaturation = vx_setall_u8(thresholds.saturation);
+	v_uint8 vLightnessAgr = vx_setall_u8(thresholds.lightnessAgr);
+
+	v_float32 vLowTanSq = vx_setall_f32(thresholds.directionLowTanSq);
+	v_float32 vHighTanSq = vx_setall_f32(thresholds.directionHighTanSq);
+	v_uint32 vPass0 = vx_setall_u32(thresholds.directionPass[0] ? 0xFFFFFFFF : 0);
+	v_uint32 vPass1 = vx_setall_u32(thresholds.directionPass[1] ? 0xFFFFFFFF : 0);
+	v_uint32 vPass2 = vx_setall_u32(thresholds.directionPass[2] ? 0xFFFFFFFF : 0);
+
+	v_int32 vMaxMagnitudeSq = vx_setall_s32(maxMagnitudeSq);
+	v_int16 vMaxGradX = vx_setall_s16((short)maxGradX);
+
+	for (; x <= width - v_uint8::nlanes; x += v_uint8::nlanes)
+	{
+		v_uint8 l = vx_load(lightness + x);
+		v_uint8 s = vx_load(saturation + x);
+		v_store(colorMask + x, ((l > vLightness) & (s > vSaturation)) | (l > vLightnessAgr));
+
+		v_uint32 pass[4];
+
+		for (int h = 0; h < 2; h++)
+		{
+			v_int16 gx = vx_load(gradX + x + h * v_int16::nlanes);
+			v_int16 gy = vx_load(gradY + x + h * v_int16::nlanes);
+			vMaxGradX = v_max(vMaxGradX, gx);
+
+			v_int32 gxSq[2], gySq[2];
+			v_mul_expand(gx, gx, gxSq[0], gxSq[1]);
+			v_mul_expand(gy, gy, gySq[0], gySq[1]);
+
+			for (int k = 0; k < 2; k++)
+			{
+				vMaxMagnitudeSq = v_max(vMaxMagnitudeSq, gxSq[k] + gySq[k]);
+
+				v_float32 sxSq = v_cvt_f32(gxSq[k]);
+				v_float32 sySq = v_cvt_f32(gySq[k]);
+
+				v_uint32 above0 = v_reinterpret_as_u32(sxSq > vLowTanSq * sySq);
+				v_uint32 above1 = above0 & v_reinterpret_as_u32(sxSq >= vHighTanSq * sySq);
+
+				pass[h * 2 + k] = (vPass0 & ~above0) | (vPass1 & above0 & ~above1) | (vPass2 & above1);
+			}
+		}
+
+		v_store(directionMask + x, v_pack_b(pass[0], pass[1], pass[2], pass[3]));
+	}
+
+	v_int32 maxGradXLow, maxGradXHigh;
+	v_expand(vMaxGradX, maxGradXLow, maxGradXHigh);
+
+	maxMagnitudeSq = v_reduce_max(vMaxMagnitudeSq);
+	maxGradX = v_reduce_max(v_max(maxGradXLow, maxGradXHigh));
+#endif
+	for (; x < width; x++)
+	{
+		uchar l = lightness[x], s = saturation[x];
+		colorMask[x] = ((l > thresholds.lightness && s > thresholds.saturation) || l > thresholds.lightnessAgr) ? 255 : 0;
+
+		int gxSq = gradX[x] * gradX[x];
+		int gySq = gradY[x] * gradY[x];
+
+		maxMagnitudeSq = std::max(maxMagnitudeSq, gxSq + gySq);
+		maxGradX = std::max(maxGradX, (int)gradX[x]);
+
+		float sxSq = (float)gxSq, sySq = (float)gySq;
+		int direction = 0;
+
+		if (sxSq > thresholds.directionLowTanSq * sySq)
+			direction = sxSq >= thresholds.directionHighTanSq * sySq ? 2 : 1;
+
+		directionMask[x] = thresholds.directionPass[direction];
+	}
+}
+
+// Second sweep over a row: normalized magnitude and x gradient thresholds, combined with the first sweep
+static void MagnitudeCombineRow(const short* gradX, const short* gradY, const uchar* colorMask, uchar* sobelMask, uchar* combinedMask,
+	int magnitudeSqThreshold, short gradXThreshold, int width)
+{
+	int x = 0;
+#if CV_SIMD
+	v_int32 vMagnitudeSq = vx_setall_s32(magnitudeSqThreshold);
+	v_int16 vGradX = vx_setall_s16(gradXThreshold);
+
+	for (; x <= width - v_uint8::nlanes; x += v_uint8::nlanes)
+	{
+		v_uint32 magnitudePass[4];
+		v_uint16 gradXPass[2];
+
+		for (int h = 0; h < 2; h++)
+		{
+			v_int16 gx = vx_load(gradX + x + h * v_int16::nlanes);
+			v_int16 gy = vx_load(gradY + x + h * v_int16::nlanes);
+			gradXPass[h] = v_reinterpret_as_u16(gx >= vGradX);
+
+			v_int32 gxSq[2], gySq[2];
+			v_mul_expand(gx, gx, gxSq[0], gxSq[1]);
+			v_mul_expand(gy, gy, gySq[0], gySq[1]);
+
+			magnitudePass[h * 2] = v_reinterpret_as_u32(gxSq[0] + gySq[0] >= vMagnitudeSq);
+			magnitudePass[h * 2 + 1] = v_reinterpret_as_u32(gxSq[1] + gySq[1] >= vMagnitudeSq);
+		}
+
+		v_uint8 sobel = vx_load(sobelMask + x) &
+			v_pack_b(magnitudePass[0], magnitudePass[1], magnitudePass[2], magnitudePass[3]) &
+			v_pack_b(gradXPass[0], gradXPass[1]);
+
+		v_store(sobelMask + x, sobel);
+		v_store(combinedMask + x, sobel | vx_load(colorMask + x));
+	}
+#endif
+	for (; x < width; x++)
+	{
+		int magnitudeSq = gradX[x] * gradX[x] + gradY[x] * gradY[x];
+		bool sobel = sobelMask[x] && magnitudeSq >= magnitudeSqThreshold && gradX[x] >= gradXThreshold;
+
+		sobelMask[x] = sobel ? 255 : 0;
+		combinedMask[x] = sobel ? 255 : colorMask[x];
+	}
+}
+
+// Bytes of each row a stripe works on: the color row, the gradients and the masks
+static const int StripeBytesPerPixel = 3 + 2 * 2 + 3;
+
+int LaneFilterStripeRows(Size size)
+{
+	// Each stripe reloads the 2 rows above and below it, so stripes much shorter than that aren't worth it
+	return StripeRows((size_t)size.width * StripeBytesPerPixel, 2, 16, std::max(size.height, 1));
+}
+
+void AllocateLaneFilter(LaneFilterData& data, Size size, bool remapped)
+{
+	int stripeRows = LaneFilterStripeRows(size);
+	int stripes = (size.height + stripeRows - 1) / stripeRows;
+
+	data.colorMask.create(size, CV_8U);
+	data.sobelMask.create(size, CV_8U);
+	data.combinedMask.create(size, CV_8U);
+	data.gradientX.create(size, CV_16S);
+	data.gradientY.create(size, CV_16S);
+
+	// Ring of the last 5 split rows and the vertical sobel rows, with 2 reflected elements on each side, for every stripe
+	data.splitRows.create(10 * stripes, size.width, CV_8U);
+	data.sobelRows.create(2 * stripes, size.width + 4, CV_16S);
+	data.stripeMaxima.create(stripes, 2, CV_32S);
+
+	if (remapped)
+		data.stripeFrames.create((stripeRows + 4) * stripes, size.width, CV_8UC3);
+}
+
+// The color mask, the gradients and the direction part of the sobel mask come from one sweep over the rows,
+// the magnitude and x gradient thresholds need the frame maxima and are applied in a second, cheaper sweep
+// Both sweeps run over stripes of rows sized to stay in L2, the stripes are independent and run in parallel
+// loadStripe(stripe, rows) is called before a stripe is filtered with the rows it will read, halo included
+// splitRow(stripe, y, lightness, saturation) then fills the two channels of row y
+template <typename LoadStripe, typename SplitRow>
+static void LaneFilterStripes(Size size, LoadStripe loadStripe, SplitRow splitRow, LaneFilterData& out, LaneFilterArgs args)
+{
+	int width = size.width, height = size.height;
+	FusedThresholds thresholds = GetFusedThresholds(args);
+
+	int stripeRows = LaneFilterStripeRows(size);
+	int stripes = (height + stripeRows - 1) / stripeRows;
+
+	AllocateLaneFilter(out, size, false);
+
+	parallel_for_(Range(0, stripes), [&](const Range& range)
+	{
+		for (int stripe = range.start; stripe < range.end; stripe++)
+		{
+			TRACE_SCOPE("Lane Filter Stripe");
+			int firstRow = stripe * stripeRows, lastRow = std::min(firstRow + stripeRows, height);
+
+			uchar* lightnessRing = out.splitRows.ptr<uchar>(stripe * 10);
+			uchar* saturationRing = out.splitRows.ptr<uchar>(stripe * 10 + 5);
+			short* smooth = out.sobelRows.ptr<short>(stripe * 2) + 2;
+			short* deriv = out.sobelRows.ptr<short>(stripe * 2 + 1) + 2;
+
+			int maxMagnitudeSq = 0, maxGradX = 0;
+			int loadedRows = std::max(firstRow - 2, 0);
+
+			loadStripe(stripe, Range(loadedRows, std::min(lastRow + 2, height)));
+
+			for (int y = firstRow; y < lastRow; y++)
+			{
+				// Split the rows needed for the 5x5 kernel, each row is split once per stripe
+				for (; loadedRows <= std::min(y + 2, height - 1); loadedRows++)
+				{
+					int slot = loadedRows % 5;
+					splitRow(stripe, loadedRows, lightnessRing + slot * width, saturationRing + slot * width);
+				}
+
+				// Same border handling as Sobel (BORDER_REFLECT_101)
+				const uchar* rows[5];
+
+				for (int k = 0; k < 5; k++)
+					rows[k] = lightnessRing + (borderInterpolate(y + k - 2, height, BORDER_REFLECT_101) % 5) * width;
+
+				SobelVerticalRow(rows, smooth, deriv, width);
+
+				smooth[-1] = smooth[1]; smooth[-2] = smooth[2];
+				smooth[width] = smooth[width - 2]; smooth[width + 1] = smooth[width - 3];
+				deriv[-1] = deriv[1]; deriv[-2] = deriv[2];
+				deriv[width] = deriv[width - 2]; deriv[width + 1] = deriv[width - 3];
+
+				short* gradX = out.gradientX.ptr<short>(y);
+				short* gradY = out.gradientY.ptr<short>(y);
+
+				SobelHorizontalRow(smooth, deriv, gradX, gradY, width);
+
+				ColorDirectionRow(rows[2], saturationRing + (y % 5) * width, gradX, gradY,
+					out.colorMask.ptr<uchar>(y), out.sobelMask.ptr<uchar>(y), thresholds, width, maxMagnitudeSq, maxGradX);
+			}
+
+			out.stripeMaxima.at<int>(stripe, 0) = maxMagnitudeSq;
+			out.stripeMaxima.at<int>(stripe, 1) = maxGradX;
+		}
+	});
+
+	int maxMagnitudeSq = 0, maxGradX = 0;
+
+	for (int stripe = 0; stripe < stripes; stripe++)
+	{
+		maxMagnitudeSq = std::max(maxMagnitudeSq, out.stripeMaxima.at<int>(stripe, 0));
+		maxGradX = std::max(maxGradX, out.stripeMaxima.at<int>(stripe, 1));
+	}
+
+	// SobelMask scales the magnitude and x gradient so that the maximum is 255 and rounds before thresholding,
+	// round(value * 255 / max) > threshold is the same as value > (threshold + 0.5) * max / 255
+	double magnitudeLimit = (args.magnitudeThreshold + 0.5) * std::sqrt((double)maxMagnitudeSq) / 255;
+	double gradXLimit = (args.xThreshold + 0.5) * maxGradX / 255;
+
+	int magnitudeSqThreshold = maxMagnitudeSq > 0 ? saturate_cast<int>(std::floor(magnitudeLimit * magnitudeLimit) + 1) : INT_MAX;
+	short gradXThreshold = maxGradX > 0 ? saturate_cast<short>(std::floor(gradXLimit) + 1) : SHRT_MAX;
+
+	parallel_for_(Range(0, stripes), [&](const Range& range)
+	{
+		TRACE_SCOPE("Lane Filter Combine");
+
+		for (int y = range.start * stripeRows; y < std::min(range.end * stripeRows, height); y++)
+		{
+			MagnitudeCombineRow(out.gradientX.ptr<short>(y), out.gradientY.ptr<short>(y), out.colorMask.ptr<uchar>(y),
+				out.sobelMask.ptr<uchar>(y), out.combinedMask.ptr<uchar>(y), magnitudeSqThreshold, gradXThreshold, width);
+		}
+	});
+}
+
+// Stripes of a frame that is already in memory, nothing to load up front
+template <typename SplitRow>
+static void LaneFilterRows(Size size, SplitRow splitRow, LaneFilterData& out, LaneFilterArgs args)
+{
+	LaneFilterStripes(size, [](int, const Range&) {}, [&](int, int y, uchar* lightness, uchar* saturation)
+	{
+		splitRow(y, lightness, saturation);
+	}, out, args);
+}
+
+// Same output as LaneFilter, but without the temporary images
+void LaneFilterFused(const Mat& in, LaneFilterData& out, LaneFilterArgs args)
+{
+	CV_Assert(in.type() == CV_8UC3 && in.cols >= 5 && in.rows >= 5);
+
+	LaneFilterRows(in.size(), [&](int y, uchar* lightness, uchar* saturation)
+	{
+		SplitLightnessSaturationRow(in.ptr<uchar>(y), lightness, saturation, in.cols);
+	}, out, args);
+}
+
+void LaneFilterYuv(const Mat& in, LaneFilterData& out, LaneFilterArgs args)
+{
+	if (in.type() == CV_8UC2)
+	{
+		CV_Assert(in.cols >= 5 && in.rows >= 5 && in.cols % 2 == 0);
+
+		LaneFilterRows(in.size(), [&](int y, uchar* lightness, uchar* saturation)
+		{
+			SplitYUYVRow(in.ptr<uchar>(y), lightness, saturation, in.cols);
+		}, out, args);
+
+		return;
+	}
+
+	// NV12 is a single channel Mat with the luma rows followed by half as many interleaved UV rows
+	CV_Assert(in.type() == CV_8UC1 && in.rows % 3 == 0 && in.cols % 2 == 0);
+
+	Size size(in.cols, in.rows * 2 / 3);
+	CV_Assert(size.width >= 5 && size.height >= 5);
+
+	LaneFilterRows(size, [&](int y, uchar* lightness, uchar* saturation)
+	{
+		SplitNV12Row(in.ptr<uchar>(y), in.ptr<uchar>(size.height + y / 2), lightness, saturation, size.width);
+	}, out, args);
+}
+
+void LaneFilterRemapped(const Mat& in, const Mat& map1, const Mat& map2, LaneFilterData& out, LaneFilterArgs args)
+{
+	CV_Assert(in.type() == CV_8UC3 && map1.size() == map2.size() && map1.cols >= 5 && map1.rows >= 5);
+
+	Size size = map1.size();
+	int stripeRows = LaneFilterStripeRows(size);
+
+	AllocateLaneFilter(out, size, true);
+
+	// Each stripe remaps its rows and the 2 row halo on either side into its own buffer, the halo rows are remapped by both neighbours
+	LaneFilterStripes(size, [&](int stripe, const Range& rows)
+	{
+		TRACE_SCOPE("Remap Stripe");
+		Mat stripeFrame = out.stripeFrames.rowRange(stripe * (stripeRows + 4), stripe * (stripeRows + 4) + rows.size());
+		remap(in, stripeFrame, map1.rowRange(rows), map2.rowRange(rows), INTER_LINEAR, BORDER_CONSTANT);
+	}, [&](int stripe, int y, uchar* lightness, uchar* saturation)
+	{
+		int firstRow = std::max(stripe * stripeRows - 2, 0);
+		SplitLightnessSaturationRow(out.stripeFrames.ptr<uchar>(stripe * (stripeRows + 4) + y - firstRow), lightness, saturation, size.width);
+	}, out, args);
+}
@@ -18,6 +18,24 @@ struct LaneFilterArgs
 struct LaneFilterData
 {
 	Mat colorMask, sobelMask, combinedMask;
+	Mat gradientX, gradientY; // Absolute sobel gradients (CV_16S), workspace for LaneFilterFused
+	Mat splitRows, sobelRows; // Row rings of every stripe, workspace for LaneFilterFused
+	Mat stripeMaxima; // Magnitude and x gradient maxima of every stripe (CV_32S)
+	Mat stripeFrames; // Remapped rows of every stripe, workspace for LaneFilterRemapped
 };
 
+void ColorMask(const Mat& in, Mat& out, LaneFilterArgs args);
+void SobelMask(const Mat& in, Mat& out, LaneFilterArgs args);
 void LaneFilter(const Mat& in, LaneFilterData& out, LaneFilterArgs args);
+void LaneFilterFused(const Mat& in, LaneFilterData& out, LaneFilterArgs args);
+// LaneFilterFused straight on a YUV frame, NV12 (CV_8UC1, height * 3 / 2 rows) or YUYV (CV_8UC2)
+// Only the luma and V are read, the BGR channels the filter uses are rebuilt from them per row
+void LaneFilterYuv(const Mat& in, LaneFilterData& out, LaneFilterArgs args);
+// LaneFilterFused on the frame remapped through map1 and map2, without the remapped frame ever existing in full
+// Each stripe of rows is remapped and filtered while it's still in L2, the output has the size of the remap table
+void LaneFilterRemapped(const Mat& in, const Mat& map1, const Mat& map2, LaneFilterData& out, LaneFilterArgs args);
+
+// Rows of the stripes the fused filters split a frame into, sized from the L2 cache
+int LaneFilterStripeRows(Size size);
+// Sizes the buffers of the fused filters, remapped also sizes the stripe buffers of LaneFilterRemapped
+void AllocateLaneFilter(LaneFilterData& data, Size size, bool remapped);
@@ -0,0 +1,63 @@
+#include "LaneGeometry.h"
+
+#include <cmath>
+
+// Reference geometry on 1280x720
+static const Size ReferenceSize(1280, 720);
+static const Point2f ReferenceSourcePoints[4] = { {580, 460}, {205, 720}, {1110, 720}, {703, 460} };
+static const Point2f ReferenceDestinationPoints[4] = { {320, 0}, {320, 720}, {960, 720}, {960, 0} };
+
+LaneGeometry CalculateLaneGeometry(Size frameSize)
+{
+    LaneGeometry geometry;
+    geometry.frameSize = frameSize;
+
+    double sx = (double)frameSize.width / ReferenceSize.width;
+    double sy = (double)frameSize.height / ReferenceSize.height;
+    double area = sx * sy;
+
+    for (int i = 0; i < 4; i++)
+    {
+        geometry.sourcePoints.push_back(Point2f((float)(ReferenceSourcePoints[i].x * sx), (float)(ReferenceSourcePoints[i].y * sy)));
+        geometry.destinationPoints.push_back(Point2f((float)(ReferenceDestinationPoints[i].x * sx), (float)(ReferenceDestinationPoints[i].y * sy)));
+    }
+
+    geometry.skyViewRect = Rect((int)lround(220 * sx), 0, (int)lround(840 * sx), frameSize.height);
+
+    // A lane is 3.7m wide and 700 sky view pixels apart, the sky view reaches 30m ahead
+    geometry.metersPerPixelX = (float)(3.7 / (700 * sx));
+    geometry.metersPerPixelY = (float)(30.0 / frameSize.height);
+
+    geometry.edgeLeft = (int)lround(125 * sx);
+    geometry.edgeRight = min((int)lround(1200 * sx), frameSize.width);
+
+    geometry.numWindows = 9;
+    geometry.windowWidth = max(2, (int)lround(200 * sx));
+    geometry.searchMargin = max(1, (int)lround(100 * sx));
+    geometry.minWindowPixels = max(1, (int)lround(10 * area));
+    geometry.minLanePixels = max(1, (int)lround(500 * area));
+
+    geometry.textScale = sy;
+
+    return geometry;
+}
+
+Size ProcessingSize(Size frameSize, double processingScale)
+{
+    processingScale = min(max(processingScale, 0.05), 1.0);
+
+    return Size(max(1, (int)lround(frameSize.width * processingScale)), max(1, (int)lround(frameSize.height * processingScale)));
+}
+
+CalibrationData ScaleCalibration(const CalibrationData& calibrationData, Size fromSize, Size toSize)
+{
+    CalibrationData scaled;
+    double sx = (double)toSize.width / fromSize.width, sy = (double)toSize.height / fromSize.height;
+
+    calibrationData.camMatrix.convertTo(scaled.camMatrix, CV_64F);
+    scaled.camMatrix.row(0) *= sx;
+    scaled.camMatrix.row(1) *= sy;
+    scaled.distortion = calibrationData.distortion.clone();
+
+    return scaled;
+}
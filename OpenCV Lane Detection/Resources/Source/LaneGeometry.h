@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Calibration.h"
+
+#include <opencv2/core.hpp>
+
+using namespace std;
+using namespace cv;
+
+// Every resolution dependent constant of the pipeline, derived from normalized coordinates for one frame size
+// The reference values are the ones the pipeline was tuned with on 1280x720 video
+struct LaneGeometry
+{
+    Size frameSize;
+
+    // Points from the car towards the horizon, aligned with a centered lane
+    vector<Point2f> sourcePoints, destinationPoints;
+    Rect skyViewRect; // Column band around the destination points (plus half a search window) used when filtering in sky view
+
+    float metersPerPixelX, metersPerPixelY;
+    int edgeLeft, edgeRight; // Sky view columns outside of [edgeLeft, edgeRight) are dropped from the lane mask
+
+    int numWindows; // Sliding windows stacked up the sky view, their height is the band of the lane mask index
+    int windowWidth, searchMargin;
+    int minWindowPixels, minLanePixels; // Pixel counts, scaled with the frame area
+
+    double textScale; // Font scale and text offsets relative to 720 rows
+};
+
+LaneGeometry CalculateLaneGeometry(Size frameSize);
+
+// Size the pipeline runs at for a processing scale, e.g. 0.5 for half of the frame width and height
+Size ProcessingSize(Size frameSize, double processingScale);
+
+// Calibration of the same camera at another resolution, the distortion is in normalized coordinates and stays the same
+CalibrationData ScaleCalibration(const CalibrationData& calibrationData, Size fromSize, Size toSize);
@@ -0,0 +1,323 @@
+#include "LaneResultChannel.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Bump whenever LaneResult or the ring layout changes, readers refuse other versions
+static const uint32_t LaneResultVersion = 2;
+static const char LaneResultMagic[8] = { 'L', 'A', 'N', 'E', 'R', 'I', 'N', 'G' };
+
+int64_t LaneResultClock(chrono::steady_clock::time_point time)
+{
+    return chrono::duration_cast<chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+int64_t LaneResultClockNow()
+{
+    return LaneResultClock(chrono::steady_clock::now());
+}
+
+// POSIX names start with a slash, Windows names are kept to the session
+static string SegmentName(const string name)
+{
+#ifdef _WIN32
+    return "Local\\" + (name.size() > 0 && name[0] == '/' ? name.substr(1) : name);
+#else
+    return name.size() > 0 && name[0] == '/' ? name : "/" + name;
+#endif
+}
+
+SharedMemorySegment::~SharedMemorySegment()
+{
+    Close();
+}
+
+bool SharedMemorySegment::Create(const string segmentName, size_t segmentSize)
+{
+    Close();
+    name = SegmentName(segmentName);
+
+#ifdef _WIN32
+    mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)segmentSize >> 32), (DWORD)segmentSize, name.c_str());
+
+    if (mapping == nullptr)
+        return false;
+
+    data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, segmentSize);
+#else
+    // A segment left over from a publisher that crashed is replaced, readers still mapping it keep the old one
+    shm_unlink(name.c_str());
+
+    int file = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+
+    if (file < 0)
+        return false;
+
+    owner = true;
+
+    if (ftruncate(file, (off_t)segmentSize) != 0)
+    {
+        close(file);
+        Close();
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    close(file);
+
+    data = mapped == MAP_FAILED ? nullptr : mapped;
+#endif
+
+    size = segmentSize;
+
+    if (data == nullptr)
+    {
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+bool SharedMemorySegment::Open(const string segmentName)
+{
+    Close();
+    name = SegmentName(segmentName);
+
+#ifdef _WIN32
+    mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+
+    if (mapping == nullptr)
+        return false;
+
+    data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+
+    MEMORY_BASIC_INFORMATION info;
+
+    if (data != nullptr && VirtualQuery(data, &info, sizeof(info)) != 0)
+        size = info.RegionSize;
+#else
+    // Mapped writable because the sequence loads are atomic operations on the shared memory
+    int file = shm_open(name.c_str(), O_RDWR, 0);
+
+    if (file < 0)
+        return false;
+
+    struct stat fileStat;
+
+    if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0)
+    {
+        size = (size_t)fileStat.st_size;
+        void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+        data = mapped == MAP_FAILED ? nullptr : mapped;
+    }
+
+    close(file);
+#endif
+
+    if (data == nullptr)
+    {
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+void SharedMemorySegment::Close()
+{
+#ifdef _WIN32
+    if (data != nullptr)
+        UnmapViewOfFile(data);
+    if (mapping != nullptr)
+        CloseHandle(mapping);
+
+    mapping = nullptr;
+#else
+    if (data != nullptr)
+        munmap(data, size);
+    if (owner)
+        shm_unlink(name.c_str());
+#endif
+
+    data = nullptr;
+    size = 0;
+    owner = false;
+}
+
+bool LaneResultPublisher::Open(const string name, uint32_t capacity)
+{
+    capacity = max<uint32_t>(capacity, 16);
+    header = nullptr;
+
+    if (!segment.Create(name, sizeof(LaneResultRingHeader) + (size_t)capacity * sizeof(LaneResultSlot)))
+        return false;
+
+    // The segment starts out zeroed, so every slot is at sequence 0 and no record looks complete
+    LaneResultRingHeader* ringHeader = (LaneResultRingHeader*)segment.Data();
+    ringHeader->version = LaneResultVersion;
+    ringHeader->capacity = capacity;
+    ringHeader->slotSize = sizeof(LaneResultSlot);
+    ringHeader->claimed.store(0, memory_order_relaxed);
+
+    // Readers check the magic last, the release makes the rest of the header visible before it
+    atomic_thread_fence(memory_order_release);
+    memcpy(ringHeader->magic, LaneResultMagic, sizeof(LaneResultMagic));
+
+    header = ringHeader;
+    slots = (LaneResultSlot*)(ringHeader + 1);
+
+    return true;
+}
+
+void LaneResultPublisher::Publish(const LaneResult& result)
+{
+    if (header == nullptr)
+        return;
+
+    uint64_t index = header->claimed.fetch_add(1, memory_order_relaxed);
+    LaneResultSlot& slot = slots[index % header->capacity];
+
+    // The slot is free once the record of the previous lap is complete, it starts out at 0
+    uint64_t previous = index >= header->capacity ? 2 * (index - header->capacity) + 2 : 0;
+    uint64_t sequence = slot.sequence.load(memory_order_acquire);
+
+    // Odd while writing, readers that overlap with the copy see the sequence change and retry
+    for (;;)
+    {
+        // This writer stalled for a whole lap and a newer record took the slot, readers count this one as dropped
+        if (sequence > previous)
+            return;
+
+        // The writer of the previous lap is still copying its record
+        if (sequence < previous)
+        {
+            this_thread::yield();
+            sequence = slot.sequence.load(memory_order_acquire);
+            continue;
+        }
+
+        if (slot.sequence.compare_exchange_weak(sequence, 2 * index + 1, memory_order_relaxed))
+            break;
+    }
+
+    atomic_thread_fence(memory_order_release);
+
+    memcpy(&slot.result, &result, sizeof(LaneResult));
+
+    slot.sequence.store(2 * index + 2, memory_order_release);
+}
+
+bool LaneResultReader::Open(const string name)
+{
+    header = nullptr;
+    started = false;
+    dropped = 0;
+
+    if (!segment.Open(name) || segment.Size() < sizeof(LaneResultRingHeader))
+        return false;
+
+    const LaneResultRingHeader* ringHeader = (const LaneResultRingHeader*)segment.Data();
+
+    if (memcmp(ringHeader->magic, LaneResultMagic, sizeof(LaneResultMagic)) != 0)
+        return false;
+
+    atomic_thread_fence(memory_order_acquire);
+
+    if (ringHeader->version != LaneResultVersion || ringHeader->slotSize != sizeof(LaneResultSlot) ||
+        segment.Size() < sizeof(LaneResultRingHeader) + (size_t)ringHeader->capacity * sizeof(LaneResultSlot))
+        return false;
+
+    header = ringHeader;
+    slots = (const LaneResultSlot*)(ringHeader + 1);
+
+    return true;
+}
+
+LaneResultReader::ReadStatus LaneResultReader::TryRead(uint64_t index, LaneResult& result) const
+{
+    const LaneResultSlot& slot = slots[index % header->capacity];
+    uint64_t complete = 2 * index + 2;
+
+    for (;;)
+    {
+        uint64_t before = slot.sequence.load(memory_order_acquire);
+
+        if (before < complete)
+            return ReadStatus::NotReady;
+        if (before > complete)
+            return ReadStatus::Overwritten;
+
+        memcpy(&result, &slot.result, sizeof(LaneResult));
+        atomic_thread_fence(memory_order_acquire);
+
+        // A writer lapped the ring during the copy, the record is gone
+        if (slot.sequence.load(memory_order_relaxed) == complete)
+            return ReadStatus::Ok;
+    }
+}
+
+bool LaneResultReader::ReadLatest(LaneResult& result) const
+{
+    if (header == nullptr)
+        return false;
+
+    uint64_t claimed = header->claimed.load(memory_order_acquire);
+    uint64_t oldest = claimed > header->capacity ? claimed - header->capacity : 0;
+
+    // The newest claims can still be in progress, fall back to the records before them
+    for (uint64_t index = claimed; index > oldest; index--)
+        if (TryRead(index - 1, result) == ReadStatus::Ok)
+            return true;
+
+    return false;
+}
+
+bool LaneResultReader::ReadNext(LaneResult& result)
+{
+    if (header == nullptr)
+        return false;
+
+    uint64_t claimed = header->claimed.load(memory_order_acquire);
+
+    // A new reader starts with the records published from now on
+    if (!started)
+    {
+        next = claimed;
+        started = true;
+    }
+
+    while (next < claimed)
+    {
+        if (claimed - next > header->capacity)
+        {
+            dropped += claimed - header->capacity - next;
+            next = claimed - header->capacity;
+        }
+
+        ReadStatus status = TryRead(next, result);
+
+        if (status == ReadStatus::NotReady)
+            return false;
+
+        next++;
+
+        if (status == ReadStatus::Ok)
+            return true;
+
+        dropped++;
+    }
+
+    return false;
+}
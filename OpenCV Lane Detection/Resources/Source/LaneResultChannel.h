@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+// Per-frame lane results published to other processes through a named shared memory ring
+// Each slot is guarded by a sequence lock, so the writers never wait on readers and a reader sees a record either whole or not at all
+// This header and LaneResultChannel.cpp only need the standard library, a downstream controller can build them on their own
+
+// Fixed layout of one published frame, the same in every process that maps the ring
+struct LaneResult
+{
+    uint64_t frameIndex;
+    int64_t captureTime; // Steady clock nanoseconds (CLOCK_MONOTONIC on Linux) when the frame was decoded
+    int64_t publishTime; // Steady clock nanoseconds when the curve fit finished
+    float leftK[3], rightK[3]; // Sky view pixel curves at the video resolution as (c, b, a) for x = a*y^2 + b*y + c
+    float leftRadius, rightRadius; // Meters
+    float vehiclePosition; // Meters from the center of the lane, positive is left
+    int32_t processingLevel; // ProcessingLevel of the frame scheduler
+    uint32_t flags;
+    uint32_t streamIndex; // Video the frame belongs to, in the order of the -v arguments, always 0 with one video
+};
+
+static_assert(sizeof(LaneResult) == 72, "LaneResult is shared between processes and must keep its layout");
+
+enum LaneResultFlags : uint32_t
+{
+    LaneResultExtrapolated = 1 // The lanes were moved on from the last fit instead of fitted to this frame
+};
+
+int64_t LaneResultClock(chrono::steady_clock::time_point time);
+int64_t LaneResultClockNow();
+
+// One slot of the ring, sequence is 2 * index + 1 while record index is written and 2 * index + 2 once it's complete
+// The sequence of a slot only ever grows, a writer that was lapped while it stalled gives its record up instead of overwriting a newer one
+struct alignas(64) LaneResultSlot
+{
+    atomic<uint64_t> sequence;
+    LaneResult result;
+};
+
+static_assert(atomic<uint64_t>::is_always_lock_free, "The sequence has to be lock free to work across processes");
+
+struct alignas(64) LaneResultRingHeader
+{
+    char magic[8];
+    uint32_t version, capacity, slotSize, reserved;
+    alignas(64) atomic<uint64_t> claimed; // Index of the next record, records below it are written or being written
+};
+
+// A named shared memory segment mapped read / write, POSIX shm_open or a Windows named file mapping
+class SharedMemorySegment
+{
+public:
+    ~SharedMemorySegment();
+
+    bool Create(const string name, size_t size);
+    bool Open(const string name);
+    void Close();
+
+    void* Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    void* data = nullptr;
+    size_t size = 0;
+    string name;
+    bool owner = false;
+#ifdef _WIN32
+    void* mapping = nullptr;
+#endif
+};
+
+// Writes the ring, any number of threads can publish at once, each claims its own slot
+// A slot is only taken over from the record one lap before, the writer waits for that one to complete first
+// The segment is created fresh on Open and removed again when the publisher goes away
+class LaneResultPublisher
+{
+public:
+    bool Open(const string name, uint32_t capacity = 256);
+    bool IsOpen() const { return header != nullptr; }
+
+    void Publish(const LaneResult& result);
+
+private:
+    SharedMemorySegment segment;
+    LaneResultRingHeader* header = nullptr;
+    LaneResultSlot* slots = nullptr;
+};
+
+// Reads the ring of a running publisher without ever blocking it
+// Records from several processing threads can be claimed out of frame order, streamIndex and frameIndex tell them apart
+class LaneResultReader
+{
+public:
+    bool Open(const string name);
+    bool IsOpen() const { return header != nullptr; }
+
+    // Newest complete record
+    bool ReadLatest(LaneResult& result) const;
+    // Every record in order of publication, false when there is nothing new yet
+    // A reader that falls more than the capacity behind skips the overwritten records and counts them as dropped
+    bool ReadNext(LaneResult& result);
+
+    uint64_t Dropped() const { return dropped; }
+
+private:
+    enum class ReadStatus { Ok, NotReady, Overwritten };
+
+    ReadStatus TryRead(uint64_t index, LaneResult& result) const;
+
+    SharedMemorySegment segment;
+    const LaneResultRingHeader* header = nullptr;
+    const LaneResultSlot* slots = nullptr;
+    uint64_t next = 0, dropped = 0;
+    bool started = false;
+};
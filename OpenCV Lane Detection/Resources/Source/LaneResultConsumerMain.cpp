@@ -0,0 +1,73 @@
+#include "LaneResultChannel.h"
+
+#include <cstdio>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+// Local consumer of the lane results published with LaneDetection -u, prints every record as it arrives
+// Shows how far behind the curve fit and the decoded frame each record is seen, on the shared steady clock
+int main(int argc, char* argv[])
+{
+    string name = "lane_results";
+    bool latestOnly = false;
+    int64_t maxRecords = -1;
+
+    for (int i = 0; i < argc; i++)
+    {
+        string arg(argv[i]);
+
+        if (arg == "-u")
+            name = argv[++i];
+        if (arg == "--latest")
+            latestOnly = true;
+        if (arg == "-n")
+            maxRecords = stoll(argv[++i]);
+    }
+
+    LaneResultReader reader;
+
+    // The publisher creates the ring when it starts, wait for it
+    while (!reader.Open(name))
+        this_thread::sleep_for(chrono::milliseconds(100));
+
+    printf("%6s %8s %10s %10s %10s %10s %12s %12s\n", "Stream", "Frame", "Left R", "Right R", "Position", "Level", "Fit -> us", "Decode -> us");
+
+    LaneResult result;
+    uint64_t lastFrame = UINT64_MAX;
+    uint32_t lastStream = UINT32_MAX;
+
+    for (int64_t records = 0; maxRecords < 0 || records < maxRecords;)
+    {
+        // Spin briefly so a new record is seen within microseconds, then back off
+        bool hasRecord = false;
+
+        for (int spin = 0; spin < 1000 && !hasRecord; spin++)
+        {
+            hasRecord = latestOnly ? reader.ReadLatest(result) && (result.frameIndex != lastFrame || result.streamIndex != lastStream) : reader.ReadNext(result);
+
+            if (!hasRecord)
+                this_thread::yield();
+        }
+
+        if (!hasRecord)
+        {
+            this_thread::sleep_for(chrono::microseconds(200));
+            continue;
+        }
+
+        int64_t now = LaneResultClockNow();
+        lastFrame = result.frameIndex;
+        lastStream = result.streamIndex;
+        records++;
+
+        printf("%6u %8llu %10.1f %10.1f %10.3f %9d%s %12.1f %12.1f\n", result.streamIndex, (unsigned long long)result.frameIndex, result.leftRadius, result.rightRadius,
+            result.vehiclePosition, result.processingLevel, (result.flags & LaneResultExtrapolated) ? "e" : " ",
+            (now - result.publishTime) / 1e3, (now - result.captureTime) / 1e3);
+    }
+
+    printf("Dropped %llu records\n", (unsigned long long)reader.Dropped());
+
+    return 0;
+}
@@ -1,6 +1,17 @@
 #include "Calibration.h"
 #include "FrameProcessing.h"
+#include "FrameScheduler.h"
+#include "FrameQueue.h"
+#include "FramePool.h"
+#include "Benchmark.h"
+#include "OutputWriter.h"
+#include "StreamEngine.h"
+#include "MapCache.h"
+#include "Trace.h"
 
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <filesystem>
 #include <opencv2/core/utils/logger.hpp>
 #include <opencv2/videoio.hpp>
@@ -8,16 +19,62 @@
 using namespace std;
 using namespace filesystem;
 
+struct FramePacket
+{
+    Mat frame;
+    int64 index = 0;
+    chrono::steady_clock::time_point decodeTime;
+    FrameRecord frameRecord;
+};
+
+static void PrintUsage(const char* program)
+{
+    cout << "Usage: " << program << " -c <calibration directory> -v <video> [options]" << endl <<
+        "  -v <video>       Video to process, several -v run in the stream engine" << endl <<
+        "  -c <directory>   Chessboard images to calibrate from, unless SaveData already has a calibration" << endl <<
+        "  -d <directory>   SaveData directory for the calibration, the caches and the frame data" << endl <<
+        "  -o <path>        Annotated output video, a directory with several videos" << endl <<
+        "  -r <path>        Lane results as CSV, a directory with several videos" << endl <<
+        "  -u <name>        Shared memory ring to publish the lane results to" << endl <<
+        "  -x <path>        Chrome trace of the pipeline stages, written on 't' and at exit" << endl <<
+        "  --headless       Process the video once as fast as possible without any windows" << endl <<
+        "  -w <threads>     Workers in headless mode and in the stream engine, one per core by default, 0 plays back on the presentation thread" << endl <<
+        "  -q <frames>      Depth of the playback queues" << endl <<
+        "  -l <ms>          Latency budget of a frame during playback, one frame interval by default" << endl <<
+        "  -p <scale>       Processing resolution relative to the video, e.g. 0.5" << endl <<
+        "  -s               Run the lane filter in sky view space" << endl <<
+        "  -f nv12|yuyv     Keep the frames in YUV, -y <width>x<height> gives the size of raw YUV files" << endl <<
+        "  -n               Show every processing step in its own window" << endl <<
+        "  -m               Combine the processing steps into the output frame" << endl <<
+        "  -t               Print the frame times after every frame" << endl <<
+        "  -b <iterations>  Benchmark the lane filter on the first frame and exit" << endl <<
+        "  -h, --help       Show this help" << endl;
+}
+
 int main(int argc, char* argv[])
 {
     // Parse the arguments
     cv::utils::logging::setLogLevel(cv::utils::logging::LOG_LEVEL_ERROR);
 
     string calibrationDirectory;
-    string videoPath;
+    vector<string> videoPaths;
+    string outputVideoPath;
+    string resultsPath;
+    path saveDataPath = path("Resources") / "SaveData";
     bool showStepsInNewWindows = false;
     bool combineStepsInFinalFrame = false;
     bool showTimeEveryFrame = false;
+    bool filterInSkyView = false;
+    double processingScale = 1.0; // Lane filter and curve fit resolution relative to the video, e.g. 0.5 or 0.25
+    int numProcessingThreads = -1; // Workers in headless mode and in the stream engine, one per core unless set. Playback uses at most one processing thread
+    int queueDepth = 3;
+    double latencyBudget = 0; // Seconds, one frame interval unless set
+    FrameFormat frameFormat = FrameFormat::BGR;
+    Size rawFrameSize; // Frame size of raw YUV files
+    int benchmarkIterations = 0;
+    bool headless = false;
+    string resultChannelName; // Shared memory ring the lane results are published to, see LaneResultChannel.h
+    string tracePath; // Chrome trace of the pipeline stages, written on 't' and at exit
 
     for (int i = 0; i < argc; i++)
     {
@@ -26,82 +83,417 @@ int main(int argc, char* argv[])
         if (arg == "-c")
             calibrationDirectory = argv[++i];
         if (arg == "-v")
-            videoPath = argv[++i];
+            videoPaths.push_back(argv[++i]);
         if (arg == "-n")
             showStepsInNewWindows = true;
         if (arg == "-m")
             combineStepsInFinalFrame = true;
         if (arg == "-t")
             showTimeEveryFrame = true;
+        if (arg == "-s")
+            filterInSkyView = true;
+        if (arg == "-p")
+            processingScale = min(max(stod(argv[++i]), 0.05), 1.0);
+        if (arg == "-w")
+            numProcessingThreads = max(0, stoi(argv[++i]));
+        if (arg == "-q")
+            queueDepth = max(1, stoi(argv[++i]));
+        if (arg == "-l")
+            latencyBudget = max(0.0, stod(argv[++i]) / 1000.0);
+        if (arg == "-f")
+        {
+            string format(argv[++i]);
+            frameFormat = format == "nv12" ? FrameFormat::NV12 : format == "yuyv" ? FrameFormat::YUYV : FrameFormat::BGR;
+        }
+        if (arg == "-y")
+            sscanf(argv[++i], "%dx%d", &rawFrameSize.width, &rawFrameSize.height);
+        if (arg == "-b")
+            benchmarkIterations = max(1, stoi(argv[++i]));
+        if (arg == "--headless")
+            headless = true;
+        if (arg == "-h" || arg == "--help")
+        {
+            PrintUsage(argv[0]);
+            return 0;
+        }
+        if (arg == "-o")
+            outputVideoPath = argv[++i];
+        if (arg == "-r")
+            resultsPath = argv[++i];
+        if (arg == "-d")
+            saveDataPath = argv[++i];
+        if (arg == "-u")
+            resultChannelName = argv[++i];
+        if (arg == "-x")
+            tracePath = argv[++i];
+    }
+
+    if (!tracePath.empty())
+    {
+#ifndef LANE_TRACE
+        cerr << "Built without LANE_TRACE, the trace will be empty" << endl;
+#endif
+        EnableTracing(true);
     }
 
-    // Calibrate the camera with all of the images in the SaveData folder
-    // Load from file if it has already been calibrated
+    TRACE_THREAD_NAME("Presentation");
+
+    // Calibrate the camera with all of the images in the calibration folder
+    // Load from file if it has already been calibrated, the corners of images seen before are cached in the SaveData folder
     CalibrationData calibrationData;
 
-    if (!calibrationData.LoadFromFile("Resources\\SaveData"))
+    if (!calibrationData.LoadFromFile(saveDataPath.string()))
+    {
+        calibrationData = CalibrateFromDirectory(calibrationDirectory, Size(9, 6), 1.0, saveDataPath.string());
+
+        calibrationData.OutputToFile(saveDataPath.string());
+    }
+
+    // Every processing thread and every stream publishes its frames into the same ring as soon as their curves are fitted
+    LaneResultPublisher resultPublisher;
+
+    if (!resultChannelName.empty() && !resultPublisher.Open(resultChannelName))
+        cerr << "Could not create the lane result channel " << resultChannelName << endl;
+
+    // With several videos, all of them run headless in the stream engine on one shared worker pool
+    // -o and -r are directories in that case, with one output per video
+    if (videoPaths.size() > 1)
     {
-        vector<Mat> calibrationImages;
+        StreamEngineArgs engineArgs;
+        engineArgs.numWorkers = numProcessingThreads > 0 ? numProcessingThreads : max(1, (int)thread::hardware_concurrency());
+        engineArgs.filterInSkyView = filterInSkyView;
+        engineArgs.combineStepsInFinalFrame = combineStepsInFinalFrame;
+        engineArgs.processingScale = processingScale;
+        engineArgs.frameFormat = frameFormat;
+        engineArgs.rawFrameSize = rawFrameSize;
+        engineArgs.saveDataPath = saveDataPath;
+        engineArgs.outputVideoDirectory = outputVideoPath;
+        engineArgs.resultsDirectory = resultsPath;
+        engineArgs.resultPublisher = resultPublisher.IsOpen() ? &resultPublisher : nullptr;
+
+        for (const path& directory : { engineArgs.outputVideoDirectory, engineArgs.resultsDirectory })
+            if (!directory.empty() && !exists(directory))
+                create_directories(directory);
+
+        StreamEngine engine(calibrationData, engineArgs);
+
+        for (const string& streamPath : videoPaths)
+            if (!engine.AddStream(streamPath))
+                cerr << "Could not open the video " << streamPath << endl;
 
-        for (const auto& file : directory_iterator(calibrationDirectory))
-            calibrationImages.push_back(imread(file.path().string()));
+        engine.Run();
+        engine.OutputToConsole();
 
-        calibrationData = Calibrate(calibrationImages, Size(9, 6), 1.0);
+        if (!tracePath.empty() && !ExportTrace(tracePath))
+            cerr << "Could not write the trace " << tracePath << endl;
 
-        calibrationData.OutputToFile("Resources\\SaveData");
+        return 0;
     }
 
     // Read the video from the specified path and get its file properties
-    VideoCapture video(videoPath);
-    assert(video.isOpened());
+    // With -f the frames are kept in YUV as they come from the source, the lane filter reads them directly
+    string videoPath = videoPaths.empty() ? "" : videoPaths[0];
+    FrameSource video;
+
+    if (!video.Open(videoPath, frameFormat, rawFrameSize))
+    {
+        cerr << "Could not open the video " << videoPath << endl;
+        return 1;
+    }
+
+    double fps = video.Fps();
+
+    if (fps <= 0)
+        fps = 30;
+
+    auto frameInterval = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1.0 / fps));
+
+    if (latencyBudget <= 0)
+        latencyBudget = 1.0 / fps;
 
-    double fps = video.get(VideoCaptureProperties::CAP_PROP_FPS);
-    int frameDelay = (int)(1000 / fps);
-    Size videoSize((int)video.get(cv::CAP_PROP_FRAME_WIDTH), (int)video.get(cv::CAP_PROP_FRAME_HEIGHT));
+    auto presentationDelay = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(latencyBudget));
+    Size videoSize = video.FrameSize();
 
     // Generate the undistort maps for use with the RemapFrame() function in ProcessFrame()
+    // and combine the undistortion and the sky view warp into a single remap table
+    // The warp points and the rest of the lane geometry are derived for the video resolution, the sky view for the processing resolution
+    // When filtering in sky view, only the column band around the destination points (plus half a search window) is produced
+    // Both are mapped from the binary cache in the SaveData folder when this camera and resolution have been seen before
     PartUndistortMapData partUndistortMapData;
-    CalculatePartUndistortMaps(partUndistortMapData, videoSize, calibrationData);
+    ViewTransformData viewTransform;
+
+    LoadOrCalculateMaps(saveDataPath.string(), videoSize, ProcessingSize(videoSize, processingScale), filterInSkyView, calibrationData, partUndistortMapData, viewTransform);
+
+    // The frame scheduler falls back to half of the processing resolution when the frames run over the latency budget
+    ViewTransformData reducedViewTransform;
+    CalculateProcessingViewTransform(reducedViewTransform, videoSize, ProcessingSize(videoSize, processingScale * 0.5), filterInSkyView, calibrationData);
+
+    // Benchmark the lane filter on the first frame instead of playing the video
+    if (benchmarkIterations > 0)
+    {
+        Mat frame, colorFrame;
+
+        if (video.Read(frame))
+        {
+            ConvertFrameToBGR(frame, colorFrame);
+            BenchmarkLaneFilter(colorFrame, LaneFilterArgs(220, 40, 205, Point2f(0.7f, 1.4f), 40, 20), benchmarkIterations);
+        }
+
+        return 0;
+    }
+
+    // Headless mode runs the video once as fast as possible without any windows, so it also works without a display
+    // The frames are processed out of order on a pool of workers, a segment of consecutive frames each, and written out in order
+    if (headless)
+    {
+        FramePoolArgs poolArgs;
+        poolArgs.numWorkers = numProcessingThreads >= 0 ? max(numProcessingThreads, 1) : max(1, (int)thread::hardware_concurrency());
+        poolArgs.filterInSkyView = filterInSkyView;
+        poolArgs.combineStepsInFinalFrame = combineStepsInFinalFrame;
+        poolArgs.renderOutput = !outputVideoPath.empty(); // A headless run that doesn't write a video has no use for the drawn output frame
+        poolArgs.resultPublisher = resultPublisher.IsOpen() ? &resultPublisher : nullptr;
+
+        // The frame data is flushed to disk in the background, so a long file doesn't keep every record in memory
+        FrameData frameData;
+        frameData.StartFlusher(saveDataPath.string(), 5.0);
+        OutputWriter outputWriter;
+
+        if ((!outputVideoPath.empty() || !resultsPath.empty()) && !outputWriter.Open(outputVideoPath, resultsPath, fps, videoSize))
+            cerr << "Could not open the output files" << endl;
+
+        FramePool pool(calibrationData, partUndistortMapData, viewTransform, poolArgs);
+        auto startTime = chrono::steady_clock::now();
+
+        int64 frameCount = pool.Run(video, [&](Mat& frame, FrameRecord& frameRecord)
+        {
+            frameData.Add(frameRecord);
+            outputWriter.Write(frame, frameRecord);
+
+            if (showTimeEveryFrame)
+                frameData.OutputToConsole(1.0);
+        });
+
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+        outputWriter.Close();
+
+        printf("Processed %lld frames in %.2f s (%.1f fps) on %d workers\n", (long long)frameCount, seconds, frameCount / max(seconds, 1e-9), poolArgs.numWorkers);
+
+        frameData.OutputToConsole(0.0);
+        frameData.OutputToFile(saveDataPath.string());
+
+        if (!tracePath.empty() && !ExportTrace(tracePath))
+            cerr << "Could not write the trace " << tracePath << endl;
+
+        return 0;
+    }
+
+    // The lane tracker carries its state from one frame to the next, so playback runs a single processing thread that sees every frame in order
+    // Handing frames round robin to several trackers would leave each of them with gaps, the lane filter already spreads each frame over the cores
+    if (numProcessingThreads > 1)
+        cerr << "Playback uses one processing thread, -w only sets the workers of headless mode and the stream engine" << endl;
+
+    numProcessingThreads = numProcessingThreads == 0 ? 0 : 1;
+
+    // The step windows show the debug views of the context that rendered them, and HighGUI windows have to be driven from the presentation thread
+    // In that case the frames are processed on the presentation thread instead of separate processing threads
+    if (showStepsInNewWindows)
+        numProcessingThreads = 0;
+
+    // Live playback degrades the processing step by step while it runs over the latency budget
+    FrameScheduler scheduler(latencyBudget);
+
+    auto setUpContext = [&](ScheduledContext& scheduledContext, bool showSteps)
+    {
+        scheduledContext.Allocate(viewTransform, reducedViewTransform, filterInSkyView);
+
+        for (PipelineContext* pipelineContext : { &scheduledContext.full, &scheduledContext.reduced })
+        {
+            pipelineContext->resultPublisher = resultPublisher.IsOpen() ? &resultPublisher : nullptr;
+            SubscribeDebugViews(pipelineContext->debugTaps, videoSize, showSteps, combineStepsInFinalFrame);
+        }
+    };
+
+    // Single producer / single consumer queues from the decode thread to the processing thread and on to the presentation thread
+    FrameQueue<FramePacket> decodedQueue(queueDepth), processedQueue(queueDepth);
+
+    atomic<bool> running = true;
+    atomic<bool> videoFinished = false;
+    atomic<int64> decodedFrameCount = 0;
+
+    // Decode stage, delivers frames at the source frame rate like a live camera would
+    thread decodeThread([&]()
+    {
+        TRACE_THREAD_NAME("Decode");
+        int64 frameIndex = 0;
+        auto nextFrameTime = chrono::steady_clock::now();
+
+        while (running)
+        {
+            FramePacket packet;
+            bool decoded;
+
+            {
+                TRACE_SCOPE("Decode");
+                decoded = video.Read(packet.frame);
+            }
+
+            // Reset the frame position if all frames have been decoded
+            if (!decoded)
+            {
+                if (frameIndex == 0)
+                {
+                    running = false;
+                    break;
+                }
+
+                if (!videoFinished)
+                    decodedFrameCount = frameIndex;
+
+                video.Rewind();
+                videoFinished = true;
+                continue;
+            }
+
+            packet.index = frameIndex++;
+            packet.decodeTime = chrono::steady_clock::now();
+            decodedQueue.Push(std::move(packet));
+
+            nextFrameTime += frameInterval;
+            auto now = chrono::steady_clock::now();
+
+            if (nextFrameTime > now)
+                this_thread::sleep_until(nextFrameTime);
+            else
+                nextFrameTime = now;
+        }
+    });
+
+    // Processing stage
+    vector<thread> processingThreads;
+
+    for (int i = 0; i < numProcessingThreads; i++)
+    {
+        processingThreads.emplace_back([&]()
+        {
+            TRACE_THREAD_NAME("Processing");
+            FramePacket packet;
+
+            // The processing thread owns its workspace buffers and lane tracker
+            ScheduledContext context;
+            setUpContext(context, false);
+
+            while (running)
+            {
+                if (!decodedQueue.Pop(packet))
+                {
+                    this_thread::sleep_for(chrono::microseconds(500));
+                    continue;
+                }
+
+                packet.frameRecord = FrameRecord();
+                packet.frameRecord.frameIndex = packet.index;
+                scheduler.RunFrame(packet.frame, packet.decodeTime, calibrationData, partUndistortMapData, viewTransform, reducedViewTransform, context, packet.frameRecord,
+                    combineStepsInFinalFrame, filterInSkyView);
 
-    TickMeter timer;
+                processedQueue.Push(std::move(packet));
+            }
+        });
+    }
+
+    // Presentation stage, runs on the main thread and shows the processed frames on the source frame clock
+    // The frame data is flushed to disk in the background, so it is kept even if the video loops forever
     FrameData frameData;
+    frameData.StartFlusher(saveDataPath.string(), 5.0);
+    ScheduledContext context; // Only used when processing on this thread
+
+    if (numProcessingThreads == 0)
+        setUpContext(context, showStepsInNewWindows);
+
+    // The annotated video and the lane results are written in the background
+    OutputWriter outputWriter;
+
+    if ((!outputVideoPath.empty() || !resultsPath.empty()) && !outputWriter.Open(outputVideoPath, resultsPath, fps, videoSize))
+        cerr << "Could not open the output files" << endl;
+
     bool frameDataFinished = false;
+    int64 lastPresentedIndex = -1;
 
-    for (;;)
+    while (running)
     {
-        Mat frame;
+        FramePacket packet;
+        bool hasPacket = false;
 
-        timer.reset();
-        timer.start();
+        if (numProcessingThreads == 0)
+        {
+            hasPacket = decodedQueue.Pop(packet);
 
-        video >> frame;
+            if (hasPacket)
+            {
+                packet.frameRecord.frameIndex = packet.index;
+                scheduler.RunFrame(packet.frame, packet.decodeTime, calibrationData, partUndistortMapData, viewTransform, reducedViewTransform, context, packet.frameRecord,
+                    combineStepsInFinalFrame, filterInSkyView);
+
+                if (showStepsInNewWindows)
+                    ShowDebugViews(context.Active().debugTaps);
+            }
+        }
+        else
+        {
+            hasPacket = processedQueue.Pop(packet);
+        }
 
-        // Reset the frame position if all frames have been displayed
-        if (frame.empty())
+        // Never show an older frame after a newer one
+        // Every frame is shown a fixed delay after it was decoded, so the output keeps the source cadence and late frames don't push the later ones back
+        if (hasPacket && packet.index > lastPresentedIndex)
         {
-            video.set(VideoCaptureProperties::CAP_PROP_POS_FRAMES, 0);
-            
-            if (frameDataFinished == false)
+            int delay = (int)chrono::duration_cast<chrono::milliseconds>(packet.decodeTime + presentationDelay - chrono::steady_clock::now()).count();
+
+            if (delay > 0 && cv::waitKey(delay) == 27)
+                running = false;
+
             {
-                frameData.OutputToFile("Resources\\SaveData");
-                frameDataFinished == true;
+                TRACE_SCOPE("Present");
+                imshow("Lane Detection", packet.frame);
             }
-            
-            timer.stop();
-            continue;
+
+            lastPresentedIndex = packet.index;
+
+            packet.frameRecord.frameIndex = packet.index;
+            frameData.Add(packet.frameRecord);
+
+            // The video loops during playback, only the first pass is written out
+            if (!videoFinished || packet.index < decodedFrameCount)
+                outputWriter.Write(packet.frame, packet.frameRecord);
+
+            if (showTimeEveryFrame)
+                frameData.OutputToConsole(1.0);
         }
-        
-        ProcessFrame(frame, calibrationData, partUndistortMapData, frameData, showStepsInNewWindows, combineStepsInFinalFrame);
 
-        imshow("Lane Detection", frame);
-        frameData.OutputMostRecentToConsole();
+        // Output the frame data once all frames of the video have been decoded
+        if (videoFinished && !frameDataFinished)
+        {
+            frameData.OutputToFile(saveDataPath.string());
+            frameDataFinished = true;
+        }
 
-        timer.stop();
+        // Also pumps the window events, stop on escape and write the trace so far on 't'
+        int key = cv::waitKey(1);
 
-        if (int totalDelay = frameDelay - timer.getAvgTimeSec() > 0)
-            cv::waitKey(totalDelay);
+        if (key == 27)
+            running = false;
+        else if (key == 't' && !tracePath.empty() && ExportTrace(tracePath))
+            printf("Wrote the trace to %s\n", tracePath.c_str());
     }
 
-    cv::waitKey(0);
+    decodeThread.join();
+
+    for (thread& processingThread : processingThreads)
+        processingThread.join();
+
+    outputWriter.Close();
+
+    if (!tracePath.empty() && !ExportTrace(tracePath))
+        cerr << "Could not write the trace " << tracePath << endl;
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,332 @@
+#include "MapCache.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace filesystem;
+
+// Bump whenever the layout or the map calculation changes, old files are then simply ignored
+static const uint32_t MapCacheVersion = 2;
+static const char MapCacheMagic[8] = { 'L', 'A', 'N', 'E', 'M', 'A', 'P', 'S' };
+static const size_t MapCacheAlignment = 64;
+
+struct MapCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t numMats;
+    uint64_t key;
+    int32_t frameWidth, frameHeight;
+    int32_t processingWidth, processingHeight;
+    int32_t viewX, viewY, viewWidth, viewHeight;
+};
+
+// The Mats follow the header as a table, the data of each is aligned and stored row after row
+struct MapCacheEntry
+{
+    int32_t rows, cols, type, reserved;
+    uint64_t offset, step;
+};
+
+shared_ptr<MappedFile> MappedFile::Open(const string filePath)
+{
+    shared_ptr<MappedFile> mappedFile(new MappedFile());
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    mappedFile->file = file;
+
+    LARGE_INTEGER fileSize;
+
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+        return nullptr;
+
+    mappedFile->size = (size_t)fileSize.QuadPart;
+    mappedFile->mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (mappedFile->mapping == nullptr)
+        return nullptr;
+
+    mappedFile->data = (const uchar*)MapViewOfFile(mappedFile->mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+    mappedFile->file = open(filePath.c_str(), O_RDONLY);
+
+    if (mappedFile->file < 0)
+        return nullptr;
+
+    struct stat fileStat;
+
+    if (fstat(mappedFile->file, &fileStat) != 0 || fileStat.st_size == 0)
+        return nullptr;
+
+    mappedFile->size = (size_t)fileStat.st_size;
+    void* data = mmap(nullptr, mappedFile->size, PROT_READ, MAP_SHARED, mappedFile->file, 0);
+    mappedFile->data = data == MAP_FAILED ? nullptr : (const uchar*)data;
+#endif
+
+    if (mappedFile->data == nullptr)
+        return nullptr;
+
+    return mappedFile;
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    if (data != nullptr)
+        UnmapViewOfFile(data);
+    if (mapping != nullptr)
+        CloseHandle(mapping);
+    if (file != nullptr)
+        CloseHandle(file);
+#else
+    if (data != nullptr)
+        munmap((void*)data, size);
+    if (file >= 0)
+        close(file);
+#endif
+}
+
+// 64 bit FNV-1a, continued from hash
+static uint64_t HashData(uint64_t hash, const void* data, size_t size)
+{
+    const uchar* bytes = (const uchar*)data;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static uint64_t HashMat(uint64_t hash, const Mat& mat)
+{
+    Mat continuous = mat.isContinuous() ? mat : mat.clone();
+    int header[3] = { continuous.rows, continuous.cols, continuous.type() };
+
+    hash = HashData(hash, header, sizeof(header));
+    return HashData(hash, continuous.data, continuous.total() * continuous.elemSize());
+}
+
+void LoadOrCalculateMaps(const string directory, const Size frameSize, const Size processingSize, bool filterInSkyView, const CalibrationData& calibrationData,
+    PartUndistortMapData& undistortMapDataOut, ViewTransformData& viewTransformOut)
+{
+    LaneGeometry frameGeometry = CalculateLaneGeometry(frameSize);
+    LaneGeometry processingGeometry = CalculateLaneGeometry(processingSize);
+    Rect viewRect = filterInSkyView ? processingGeometry.skyViewRect : Rect(Point(0, 0), processingSize);
+
+    uint64_t key = 14695981039346656037ull;
+    int geometry[8] = { frameSize.width, frameSize.height, processingSize.width, processingSize.height, viewRect.x, viewRect.y, viewRect.width, viewRect.height };
+
+    key = HashData(key, &MapCacheVersion, sizeof(MapCacheVersion));
+    key = HashData(key, geometry, sizeof(geometry));
+    key = HashData(key, frameGeometry.sourcePoints.data(), frameGeometry.sourcePoints.size() * sizeof(Point2f));
+    key = HashData(key, frameGeometry.destinationPoints.data(), frameGeometry.destinationPoints.size() * sizeof(Point2f));
+    key = HashData(key, processingGeometry.sourcePoints.data(), processingGeometry.sourcePoints.size() * sizeof(Point2f));
+    key = HashData(key, processingGeometry.destinationPoints.data(), processingGeometry.destinationPoints.size() * sizeof(Point2f));
+    key = HashMat(key, calibrationData.camMatrix);
+    key = HashMat(key, calibrationData.distortion);
+
+    char fileName[80];
+    snprintf(fileName, sizeof(fileName), "maps_%dx%d_%dx%d_%016llx.bin", frameSize.width, frameSize.height, processingSize.width, processingSize.height, (unsigned long long)key);
+    string filePath = (filesystem::path(directory) / fileName).string();
+
+    if (LoadMapCache(filePath, frameSize, processingSize, viewRect, calibrationData, key, undistortMapDataOut, viewTransformOut))
+        return;
+
+    undistortMapDataOut = PartUndistortMapData();
+    CalculatePartUndistortMaps(undistortMapDataOut, frameSize, calibrationData);
+
+    CalculateProcessingViewTransform(viewTransformOut, frameSize, processingSize, filterInSkyView, calibrationData);
+
+    if (!exists(directory))
+        create_directories(directory);
+
+    SaveMapCache(filePath, calibrationData, key, undistortMapDataOut, viewTransformOut);
+}
+
+bool LoadMapCache(const string filePath, const Size frameSize, const Size processingSize, const Rect viewRect, const CalibrationData& calibrationData, uint64_t key,
+    PartUndistortMapData& undistortMapDataOut, ViewTransformData& viewTransformOut)
+{
+    shared_ptr<MappedFile> mappedFile = MappedFile::Open(filePath);
+
+    if (!mappedFile || mappedFile->Size() < sizeof(MapCacheHeader))
+        return false;
+
+    const uchar* data = mappedFile->Data();
+    size_t size = mappedFile->Size();
+
+    MapCacheHeader header;
+    memcpy(&header, data, sizeof(header));
+
+    if (memcmp(header.magic, MapCacheMagic, sizeof(MapCacheMagic)) != 0 || header.version != MapCacheVersion || header.key != key ||
+        Size(header.frameWidth, header.frameHeight) != frameSize || Size(header.processingWidth, header.processingHeight) != processingSize ||
+        Rect(header.viewX, header.viewY, header.viewWidth, header.viewHeight) != viewRect ||
+        header.numMats < 7 || header.numMats % 2 != 1 || sizeof(MapCacheHeader) + header.numMats * sizeof(MapCacheEntry) > size)
+        return false;
+
+    // Point a Mat header at every entry, after checking that it lies inside the file
+    vector<Mat> mats;
+
+    for (uint32_t i = 0; i < header.numMats; i++)
+    {
+        MapCacheEntry entry;
+        memcpy(&entry, data + sizeof(MapCacheHeader) + i * sizeof(MapCacheEntry), sizeof(entry));
+
+        if (entry.rows < 0 || entry.cols < 0 || (entry.type & ~CV_MAT_TYPE_MASK) != 0 || entry.step != (uint64_t)entry.cols * CV_ELEM_SIZE(entry.type) ||
+            entry.offset > size || (entry.rows > 0 && entry.step > (size - entry.offset) / entry.rows))
+            return false;
+
+        // The mapping is read-only, the Mats must never be written to
+        mats.push_back(Mat(entry.rows, entry.cols, entry.type, (void*)(data + entry.offset), (size_t)entry.step));
+    }
+
+    // A truncated or foreign file can still have a valid table, every Mat has to be exactly what the remaps expect
+    auto isMat = [&](uint32_t i, Size matSize, int type) { return mats[i].size() == matSize && mats[i].type() == type; };
+    Size viewSize = viewRect.size();
+    int partRows = UndistortMapPartRows(frameSize);
+    uint32_t numParts = (uint32_t)((frameSize.height + partRows - 1) / partRows);
+
+    if (!isMat(2, Size(3, 3), CV_64F) || !isMat(3, Size(3, 3), CV_64F) || !isMat(6, Size(3, 3), CV_64F) ||
+        !isMat(4, viewSize, CV_16SC2) || !isMat(5, viewSize, CV_16UC1) || header.numMats != 7 + 2 * numParts)
+        return false;
+
+    for (uint32_t i = 0; i < numParts; i++)
+    {
+        Size partSize(frameSize.width, min(partRows, frameSize.height - (int)i * partRows));
+
+        if (!isMat(7 + 2 * i, partSize, CV_16SC2) || !isMat(8 + 2 * i, partSize, CV_16UC1))
+            return false;
+    }
+
+    // The hash only picks the file, the calibration has to match exactly
+    if (mats[0].size() != calibrationData.camMatrix.size() || mats[0].type() != calibrationData.camMatrix.type() || norm(mats[0], calibrationData.camMatrix, NORM_INF) != 0 ||
+        mats[1].size() != calibrationData.distortion.size() || mats[1].type() != calibrationData.distortion.type() || norm(mats[1], calibrationData.distortion, NORM_INF) != 0)
+        return false;
+
+    viewTransformOut.warpMatrix = mats[2].clone();
+    viewTransformOut.inverseWarpMatrix = mats[3].clone();
+    viewTransformOut.map1 = mats[4];
+    viewTransformOut.map2 = mats[5];
+    viewTransformOut.outputInverseWarpMatrix = mats[6].clone();
+    viewTransformOut.frameSize = processingSize;
+    viewTransformOut.outputSize = frameSize;
+    viewTransformOut.viewRect = viewRect;
+    viewTransformOut.viewSize = viewRect.size();
+    viewTransformOut.mappedFile = mappedFile;
+
+    undistortMapDataOut = PartUndistortMapData();
+    undistortMapDataOut.mappedFile = mappedFile;
+
+    for (uint32_t i = 7; i < header.numMats; i += 2)
+    {
+        undistortMapDataOut.map1_parts.push_back(mats[i]);
+        undistortMapDataOut.map2_parts.push_back(mats[i + 1]);
+    }
+
+    return true;
+}
+
+// Written to a temporary file and renamed into place, so other processes never map a half written cache
+bool SaveMapCache(const string filePath, const CalibrationData& calibrationData, uint64_t key, const PartUndistortMapData& undistortMapData, const ViewTransformData& viewTransform)
+{
+    vector<Mat> mats = { calibrationData.camMatrix, calibrationData.distortion, viewTransform.warpMatrix, viewTransform.inverseWarpMatrix, viewTransform.map1, viewTransform.map2,
+        viewTransform.outputInverseWarpMatrix };
+
+    for (size_t i = 0; i < undistortMapData.map1_parts.size(); i++)
+    {
+        mats.push_back(undistortMapData.map1_parts[i]);
+        mats.push_back(undistortMapData.map2_parts[i]);
+    }
+
+    MapCacheHeader header = {};
+    memcpy(header.magic, MapCacheMagic, sizeof(MapCacheMagic));
+    header.version = MapCacheVersion;
+    header.numMats = (uint32_t)mats.size();
+    header.key = key;
+    header.frameWidth = viewTransform.outputSize.width;
+    header.frameHeight = viewTransform.outputSize.height;
+    header.processingWidth = viewTransform.frameSize.width;
+    header.processingHeight = viewTransform.frameSize.height;
+    header.viewX = viewTransform.viewRect.x;
+    header.viewY = viewTransform.viewRect.y;
+    header.viewWidth = viewTransform.viewRect.width;
+    header.viewHeight = viewTransform.viewRect.height;
+
+    vector<MapCacheEntry> entries(mats.size());
+    uint64_t offset = sizeof(MapCacheHeader) + mats.size() * sizeof(MapCacheEntry);
+
+    for (size_t i = 0; i < mats.size(); i++)
+    {
+        offset = (offset + MapCacheAlignment - 1) / MapCacheAlignment * MapCacheAlignment;
+
+        entries[i].rows = mats[i].rows;
+        entries[i].cols = mats[i].cols;
+        entries[i].type = mats[i].type();
+        entries[i].reserved = 0;
+        entries[i].offset = offset;
+        entries[i].step = mats[i].cols * mats[i].elemSize();
+
+        offset += entries[i].step * entries[i].rows;
+    }
+
+    string temporaryPath = filePath + ".tmp" + to_string(chrono::steady_clock::now().time_since_epoch().count());
+
+    {
+        ofstream file(temporaryPath, ios::binary | ios::trunc);
+
+        if (!file)
+            return false;
+
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)entries.data(), entries.size() * sizeof(MapCacheEntry));
+
+        static const char padding[MapCacheAlignment] = {};
+
+        for (size_t i = 0; i < mats.size(); i++)
+        {
+            file.write(padding, (streamsize)(entries[i].offset - (uint64_t)file.tellp()));
+
+            for (int row = 0; row < mats[i].rows; row++)
+                file.write((const char*)mats[i].ptr(row), (streamsize)entries[i].step);
+        }
+
+        if (!file)
+        {
+            file.close();
+            filesystem::remove(temporaryPath);
+            return false;
+        }
+    }
+
+    error_code error;
+    filesystem::rename(temporaryPath, filePath, error);
+
+    if (error)
+    {
+        filesystem::remove(temporaryPath, error);
+        return false;
+    }
+
+    return true;
+}
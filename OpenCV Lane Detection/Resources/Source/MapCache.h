@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Calibration.h"
+#include "Undistortion.h"
+#include "ViewTransform.h"
+
+#include <memory>
+#include <string>
+#include <opencv2/core.hpp>
+
+using namespace std;
+using namespace cv;
+
+// Read-only memory mapping of a whole file, shared between every Mat that points into it
+class MappedFile
+{
+public:
+    static shared_ptr<MappedFile> Open(const string filePath);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uchar* Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    MappedFile() = default;
+
+    const uchar* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#else
+    int file = -1;
+#endif
+};
+
+// Loads the undistort maps and the view transform from the binary cache in directory, or calculates and stores them on a miss
+// The undistort maps are for the full frame size, the view transform samples a frame scaled down to processingSize
+// Both use the lane geometry derived for their resolution, filterInSkyView limits the sky view to the geometry's skyViewRect
+// Cache files are keyed by both resolutions, the view rect, the warp points and a hash of the calibration
+// A hit maps the file read-only and points the Mats straight into it, so processes on the same machine share the pages
+void LoadOrCalculateMaps(const string directory, const Size frameSize, const Size processingSize, bool filterInSkyView, const CalibrationData& calibrationData,
+    PartUndistortMapData& undistortMapDataOut, ViewTransformData& viewTransformOut);
+
+bool LoadMapCache(const string filePath, const Size frameSize, const Size processingSize, const Rect viewRect, const CalibrationData& calibrationData, uint64_t key,
+    PartUndistortMapData& undistortMapDataOut, ViewTransformData& viewTransformOut);
+bool SaveMapCache(const string filePath, const CalibrationData& calibrationData, uint64_t key, const PartUndistortMapData& undistortMapData, const ViewTransformData& viewTransform);
@@ -0,0 +1,112 @@
+#include "OutputWriter.h"
+
+#include <chrono>
+#include <filesystem>
+
+using namespace filesystem;
+
+OutputWriter::OutputWriter(size_t queueDepth) : queue(queueDepth)
+{
+}
+
+OutputWriter::~OutputWriter()
+{
+	Close();
+}
+
+bool OutputWriter::Open(const string videoPath, const string resultsPath, double fps, Size frameSize)
+{
+	Close();
+
+	if (!videoPath.empty())
+	{
+		// MJPG for .avi, which every OpenCV build can write, mp4v otherwise
+		string extension = filesystem::path(videoPath).extension().string();
+		int fourcc = extension == ".avi" ? VideoWriter::fourcc('M', 'J', 'P', 'G') : VideoWriter::fourcc('m', 'p', '4', 'v');
+
+		if (!videoWriter.open(videoPath, fourcc, fps, frameSize))
+			return false;
+	}
+
+	if (!resultsPath.empty())
+	{
+		resultsFile = fopen(resultsPath.c_str(), "w");
+
+		if (resultsFile == nullptr)
+		{
+			videoWriter.release();
+			return false;
+		}
+
+		setvbuf(resultsFile, nullptr, _IOFBF, 1 << 16);
+		fputs("frame,left_c,left_b,left_a,right_c,right_b,right_a,left_radius,right_radius,vehicle_position\n", resultsFile);
+	}
+
+	closing = false;
+	writer = thread(&OutputWriter::Run, this);
+
+	return true;
+}
+
+void OutputWriter::Write(Mat& frame, const FrameRecord& record)
+{
+	if (!IsOpen())
+		return;
+
+	Item item;
+	item.frame = frame;
+	item.record = record;
+
+	while (!queue.TryPush(item))
+		this_thread::sleep_for(chrono::microseconds(200));
+}
+
+void OutputWriter::Close()
+{
+	if (!writer.joinable())
+		return;
+
+	closing = true;
+	writer.join();
+
+	videoWriter.release();
+
+	if (resultsFile != nullptr)
+	{
+		fclose(resultsFile);
+		resultsFile = nullptr;
+	}
+}
+
+// Runs on the writer thread, keeps going until the queue is drained after Close()
+void OutputWriter::Run()
+{
+	Item item;
+
+	for (;;)
+	{
+		// Closing is only set after the last Write(), so when it was seen before an empty Pop() everything has been written
+		bool finishing = closing;
+
+		if (!queue.Pop(item))
+		{
+			if (finishing)
+				break;
+
+			this_thread::sleep_for(chrono::microseconds(500));
+			continue;
+		}
+
+		if (videoWriter.isOpened())
+			videoWriter.write(item.frame);
+
+		if (resultsFile != nullptr)
+		{
+			const FrameRecord& record = item.record;
+
+			fprintf(resultsFile, "%lld,%g,%g,%g,%g,%g,%g,%g,%g,%g\n", (long long)record.frameIndex,
+				record.leftK[0], record.leftK[1], record.leftK[2], record.rightK[0], record.rightK[1], record.rightK[2],
+				record.leftRadius, record.rightRadius, record.vehiclePosition);
+		}
+	}
+}
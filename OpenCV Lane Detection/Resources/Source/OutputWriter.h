@@ -0,0 +1,52 @@
+#pragma once
+
+#include "FrameData.h"
+#include "FrameQueue.h"
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+
+using namespace std;
+using namespace cv;
+
+// Writes the annotated frames and the per-frame lane results from a background thread
+// Encoding is slow compared to the processing, so the caller only hands the frame over and moves on
+class OutputWriter
+{
+public:
+	OutputWriter(size_t queueDepth = 8);
+	~OutputWriter();
+
+	OutputWriter(const OutputWriter&) = delete;
+	OutputWriter& operator=(const OutputWriter&) = delete;
+
+	// Either path may be empty to skip that output
+	bool Open(const string videoPath, const string resultsPath, double fps, Size frameSize);
+
+	// Waits for room in the queue instead of dropping frames, the output has to be complete
+	void Write(Mat& frame, const FrameRecord& record);
+
+	// Writes out everything still queued and closes the files
+	void Close();
+
+	bool IsOpen() const { return writer.joinable(); }
+
+private:
+	struct Item
+	{
+		Mat frame;
+		FrameRecord record;
+	};
+
+	void Run();
+
+	FrameQueue<Item> queue;
+	VideoWriter videoWriter;
+	FILE* resultsFile = nullptr;
+	thread writer;
+	atomic<bool> closing = false;
+};
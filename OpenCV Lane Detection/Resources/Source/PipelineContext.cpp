@@ -0,0 +1,108 @@
+#include "PipelineContext.h"
+
+#include <cstdlib>
+#include <new>
+
+void PipelineContext::Allocate(const ViewTransformData& viewTransform, bool filterInSkyView)
+{
+    frameSize = viewTransform.frameSize;
+    outputSize = viewTransform.outputSize;
+    geometry = CalculateLaneGeometry(frameSize);
+    outputGeometry = CalculateLaneGeometry(outputSize);
+
+    // Lane filter buffers cover the sky view band or the whole raw frame
+    Size filterSize = filterInSkyView ? viewTransform.viewSize : frameSize;
+
+    if (outputSize != frameSize)
+        scaledFrame.create(frameSize, CV_8UC3);
+
+    undistorted.create(outputSize, CV_8UC3);
+    skyViewMask.create(viewTransform.viewSize, CV_8U);
+    binary.create(frameSize, CV_8U);
+
+    AllocateLaneFilter(laneFilterData, filterSize, filterInSkyView);
+    maskIndex.Allocate(frameSize, frameSize.height / geometry.numWindows);
+
+    curveData.leftWindows.reserve(16);
+    curveData.rightWindows.reserve(16);
+    curveData.leftPixelK.create(3, 1, CV_32F);
+    curveData.rightPixelK.create(3, 1, CV_32F);
+    curveData.leftRealK.create(3, 1, CV_32F);
+    curveData.rightRealK.create(3, 1, CV_32F);
+    curveData.leftCurvePoints.reserve(frameSize.height);
+    curveData.rightCurvePoints.reserve(frameSize.height);
+
+    // The lane pixel buffers grow with the lanes, start them at a generous share of the frame
+    int lanePixelCapacity = frameSize.area() / 16;
+
+    for (LanePixels* lanePixels : { &laneTracker.leftLanePixels, &laneTracker.rightLanePixels })
+    {
+        lanePixels->x.reserve(lanePixelCapacity);
+        lanePixels->y.reserve(lanePixelCapacity);
+    }
+
+    projectionData.lane.create(outputSize, CV_8U);
+    projectionData.skyViewPolygon.reserve(frameSize.height * 2);
+    projectionData.framePolygon.reserve(frameSize.height * 2);
+    projectionData.lanePolygon.reserve(frameSize.height * 2);
+}
+
+atomic<size_t> AllocationCounter::heapAllocations = 0;
+
+AllocationCounter& AllocationCounter::Instance()
+{
+    static AllocationCounter instance;
+    return instance;
+}
+
+void AllocationCounter::Install()
+{
+    previousAllocator = Mat::getDefaultAllocator();
+    Mat::setDefaultAllocator(this);
+}
+
+void AllocationCounter::Uninstall()
+{
+    Mat::setDefaultAllocator(previousAllocator);
+}
+
+// Counts and forwards to OpenCV's standard allocator, which also frees the buffers
+UMatData* AllocationCounter::allocate(int dims, const int* sizes, int type, void* data, size_t* step, AccessFlag flags, UMatUsageFlags usageFlags) const
+{
+    if (data == nullptr)
+        matAllocations.fetch_add(1, memory_order_relaxed);
+
+    return Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+}
+
+bool AllocationCounter::allocate(UMatData* data, AccessFlag accessFlags, UMatUsageFlags usageFlags) const
+{
+    return Mat::getStdAllocator()->allocate(data, accessFlags, usageFlags);
+}
+
+void AllocationCounter::deallocate(UMatData* data) const
+{
+    Mat::getStdAllocator()->deallocate(data);
+}
+
+#ifdef LANE_COUNT_HEAP_ALLOCATIONS
+void* operator new(size_t size)
+{
+    AllocationCounter::heapAllocations.fetch_add(1, memory_order_relaxed);
+
+    if (void* ptr = malloc(size ? size : 1))
+        return ptr;
+
+    throw bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+#endif
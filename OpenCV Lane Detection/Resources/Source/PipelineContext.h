@@ -0,0 +1,75 @@
+#pragma once
+
+#include "ViewTransform.h"
+#include "LaneFilter.h"
+#include "SkyView.h"
+#include "Curves.h"
+#include "DebugTaps.h"
+#include "LaneGeometry.h"
+#include "LaneResultChannel.h"
+
+#include <atomic>
+#include <chrono>
+#include <opencv2/core.hpp>
+
+using namespace std;
+using namespace cv;
+
+// Owns every workspace buffer used by ProcessFrame, so that after the buffers are sized no frame allocates
+// One context per processing thread, the calibration and view transform are shared read-only between them
+struct PipelineContext
+{
+	Size frameSize, outputSize; // Processing and video resolution
+	LaneGeometry geometry, outputGeometry; // Derived for the processing and the video resolution
+	Mat colorFrame; // YUV frames converted to BGR, only when something needs the color frame
+	Mat scaledFrame; // Raw frame scaled down to the processing resolution
+	Mat undistorted, skyViewMask, binary;
+	Mat tapMap1, tapMap2; // Remap table scaled down for the sky view debug view
+
+	LaneFilterData laneFilterData;
+	LaneMaskIndex maskIndex; // Built over binary while it is written, the sliding windows are placed from it
+	CurveFitData curveData;
+	LaneTrackerData laneTracker;
+	ProjectionData projectionData;
+
+	// Intermediate views are only rendered for their subscribers
+	// Without renderOutput only the lane results are produced and the frame is left as it was decoded
+	DebugTaps debugTaps;
+	bool renderOutput = true;
+
+	// Set by the frame scheduler to move the lanes on from the last fit instead of filtering this frame
+	bool extrapolateLanes = false;
+
+	// Publishes the lane results of every frame as soon as the curve fit is done, shared by all contexts
+	LaneResultPublisher* resultPublisher = nullptr;
+	chrono::steady_clock::time_point decodeTime; // Of the frame being processed, published with its results
+	uint32_t streamIndex = 0; // Published with the results, tells the videos of the stream engine apart
+
+	// Sizes all of the buffers for the resolution, so even the first frame doesn't allocate inside the stages
+	void Allocate(const ViewTransformData& viewTransform, bool filterInSkyView);
+};
+
+// Counts the Mat buffers allocated through OpenCV's default allocator once installed
+// LaneBenchmark takes the count around every stage and fails when one that runs per frame still allocates after its warm up, see the SteadyStateAllocations test
+// Building with LANE_COUNT_HEAP_ALLOCATIONS also counts every operator new, including OpenCV internals such as fillPoly and putText
+class AllocationCounter : public MatAllocator
+{
+public:
+	static AllocationCounter& Instance();
+
+	void Install();
+	void Uninstall();
+
+	size_t MatAllocations() const { return matAllocations.load(memory_order_relaxed); }
+	size_t HeapAllocations() const { return heapAllocations.load(memory_order_relaxed); }
+
+	UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, AccessFlag flags, UMatUsageFlags usageFlags) const override;
+	bool allocate(UMatData* data, AccessFlag accessFlags, UMatUsageFlags usageFlags) const override;
+	void deallocate(UMatData* data) const override;
+
+	static atomic<size_t> heapAllocations;
+
+private:
+	mutable atomic<size_t> matAllocations = 0;
+	MatAllocator* previousAllocator = nullptr;
+};
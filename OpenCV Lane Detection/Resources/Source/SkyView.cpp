@@ -1,5 +1,3 @@
-#pragma once
-
 #include "SkyView.h"
 
 #include <iostream>
@@ -16,22 +14,51 @@ void SkyView(const Mat& in, Mat& out, vector<Point2f> sourcePoints, vector<Point
 	warpPerspective(in, out, warpMatrix, in.size(), INTER_LINEAR);
 }
 
-void ProjectLane(const Mat& originalIn, Mat& out, vector<Point2f> sourcePoints, vector<Point2f> destinationPoints, CurveFitData curveData, Scalar color)
+void ProjectLane(const Mat& originalIn, Mat& out, const Mat& inverseWarpMatrix, int skyViewWidth, const CurveFitData& curveData, ProjectionData& projectionData, Scalar color)
 {
-	Mat lane = Mat::zeros(originalIn.size(), CV_8UC3);
+	if (out.data != originalIn.data)
+		originalIn.copyTo(out);
 
-	// Create a new vector that outlines the bounds of the polygon (clockwise from the bottom left) and fill the shape
-	vector<Point> allLanePoints;
+	// Outline the lane in sky view (clockwise from the bottom left)
+	// The columns are kept inside the sky view, which the old full frame warp clipped the polygon to
+	vector<Point2f>& skyViewPolygon = projectionData.skyViewPolygon;
+	float maxX = (float)skyViewWidth;
 
-	allLanePoints.insert(allLanePoints.end(), curveData.leftCurvePoints.begin(), curveData.leftCurvePoints.end());
-	allLanePoints.insert(allLanePoints.end(), curveData.rightCurvePoints.rbegin(), curveData.rightCurvePoints.rend());
+	skyViewPolygon.clear();
 
-	fillPoly(lane, allLanePoints, color);
+	for (const Point& point : curveData.leftCurvePoints)
+		skyViewPolygon.push_back(Point2f(min(max((float)point.x, 0.0f), maxX), (float)point.y));
 
-	// Undo the sky view and add the lane to the original image
-	Mat warpMatrix = getPerspectiveTransform(sourcePoints, destinationPoints);
-	warpPerspective(lane, lane, warpMatrix, lane.size(), INTER_LINEAR);
+	for (auto it = curveData.rightCurvePoints.rbegin(); it != curveData.rightCurvePoints.rend(); ++it)
+		skyViewPolygon.push_back(Point2f(min(max((float)it->x, 0.0f), maxX), (float)it->y));
+
+	if (skyViewPolygon.size() < 3)
+		return;
+
+	// Undo the sky view on the outline only, then fill it straight in the camera frame
+	vector<Point2f>& framePolygon = projectionData.framePolygon;
+	vector<Point>& lanePolygon = projectionData.lanePolygon;
+
+	perspectiveTransform(skyViewPolygon, framePolygon, inverseWarpMatrix);
+
+	lanePolygon.clear();
+
+	for (const Point2f& point : framePolygon)
+		lanePolygon.push_back(Point(cvRound(point.x), cvRound(point.y)));
+
+	Rect laneRect = boundingRect(lanePolygon) & Rect(Point(0, 0), out.size());
+
+	if (laneRect.empty())
+		return;
+
+	// Only the rows and columns under the lane are cleared, filled and blended
+	projectionData.lane.create(out.size(), CV_8U);
+	Mat laneMask = projectionData.lane(laneRect);
+	Mat outLane = out(laneRect);
+
+	laneMask.setTo(Scalar::all(0));
+	fillPoly(laneMask, lanePolygon, Scalar(255), LINE_8, 0, -laneRect.tl());
 
-	out = originalIn.clone();
-	addWeighted(out, 1, lane, 0.3, 0, out);
+	// Same result as adding the lane with a weight of 0.3 over the whole frame
+	add(outLane, color * 0.3, outLane, laneMask);
 }
\ No newline at end of file
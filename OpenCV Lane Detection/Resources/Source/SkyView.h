@@ -7,5 +7,14 @@
 using namespace std;
 using namespace cv;
 
+// Workspace reused by ProjectLane between frames
+struct ProjectionData
+{
+	Mat lane; // Polygon mask, only the rows under the lane are touched
+	vector<Point2f> skyViewPolygon, framePolygon;
+	vector<Point> lanePolygon;
+};
+
 void SkyView(const Mat& in, Mat& out, vector<Point2f> sourcePoints, vector<Point2f> destinationPoints);
-void ProjectLane(const Mat& originalIn, Mat& out, vector<Point2f> sourcePoints, vector<Point2f> destinationPoints, CurveFitData curveData, Scalar color = Scalar_(0, 255, 0));
\ No newline at end of file
+// Blends the lane into out, which is a copy of originalIn unless both are the same Mat, then only the pixels under the lane are touched
+void ProjectLane(const Mat& originalIn, Mat& out, const Mat& inverseWarpMatrix, int skyViewWidth, const CurveFitData& curveData, ProjectionData& projectionData, Scalar color = Scalar_(0, 255, 0));
\ No newline at end of file
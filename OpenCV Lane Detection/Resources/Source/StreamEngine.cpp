@@ -0,0 +1,199 @@
+#include "StreamEngine.h"
+#include "FrameProcessing.h"
+#include "MapCache.h"
+#include "Trace.h"
+
+#include <chrono>
+#include <cstdio>
+
+StreamEngine::StreamEngine(const CalibrationData& calibrationData, StreamEngineArgs args) :
+    calibrationData(calibrationData), args(args)
+{
+    this->args.numWorkers = max(this->args.numWorkers, 1);
+}
+
+StreamEngine::~StreamEngine()
+{
+    for (unique_ptr<Stream>& stream : streams)
+        if (stream->outputWriter)
+            stream->outputWriter->Close();
+}
+
+// Streams with the same resolution share one set of remap tables, they're by far the largest read-only data
+shared_ptr<const SharedStreamData> StreamEngine::GetSharedData(Size frameSize)
+{
+    lock_guard<mutex> guard(sharedDataLock);
+    shared_ptr<const SharedStreamData>& data = sharedData[{ frameSize.width, frameSize.height }];
+
+    if (!data)
+    {
+        auto newData = make_shared<SharedStreamData>();
+
+        LoadOrCalculateMaps(args.saveDataPath.string(), frameSize, ProcessingSize(frameSize, args.processingScale), args.filterInSkyView, calibrationData,
+            newData->undistortMapData, newData->viewTransform);
+
+        data = newData;
+    }
+
+    return data;
+}
+
+bool StreamEngine::AddStream(const string videoPath)
+{
+    auto stream = make_unique<Stream>();
+    stream->videoPath = videoPath;
+
+    if (!stream->video.Open(videoPath, args.frameFormat, args.rawFrameSize))
+        return false;
+
+    Size frameSize = stream->video.FrameSize();
+    double fps = stream->video.Fps();
+
+    stream->shared = GetSharedData(frameSize);
+    stream->context.Allocate(stream->shared->viewTransform, args.filterInSkyView);
+    stream->context.renderOutput = !args.outputVideoDirectory.empty();
+    stream->context.resultPublisher = args.resultPublisher;
+    stream->context.streamIndex = (uint32_t)streams.size();
+    SubscribeDebugViews(stream->context.debugTaps, frameSize, false, args.combineStepsInFinalFrame);
+    stream->frameData = make_unique<FrameData>();
+
+    // Output files are named after the video, the stream index keeps two videos with the same name apart
+    string name = path(videoPath).stem().string() + "_" + to_string(streams.size());
+    string outputVideoPath = args.outputVideoDirectory.empty() ? "" : (args.outputVideoDirectory / (name + ".mp4")).string();
+    string resultsPath = args.resultsDirectory.empty() ? "" : (args.resultsDirectory / (name + ".csv")).string();
+
+    if (!outputVideoPath.empty() || !resultsPath.empty())
+    {
+        stream->outputWriter = make_unique<OutputWriter>();
+
+        if (!stream->outputWriter->Open(outputVideoPath, resultsPath, fps > 0 ? fps : 30, frameSize))
+            return false;
+    }
+
+    streams.push_back(std::move(stream));
+
+    return true;
+}
+
+void StreamEngine::Run()
+{
+    if (streams.empty())
+        return;
+
+    // The parallelism comes from running streams side by side, so keep OpenCV from oversubscribing the cores
+    int defaultThreads = getNumThreads();
+
+    if (args.numWorkers > 1)
+        setNumThreads(1);
+
+    remainingStreams = streams.size();
+    startTime = chrono::steady_clock::now();
+
+    vector<thread> workers;
+
+    for (int i = 0; i < args.numWorkers; i++)
+        workers.emplace_back(&StreamEngine::Worker, this);
+
+    for (thread& worker : workers)
+        worker.join();
+
+    seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    setNumThreads(defaultThreads);
+
+    for (size_t i = 0; i < streams.size(); i++)
+    {
+        Stream& stream = *streams[i];
+
+        if (stream.outputWriter)
+            stream.outputWriter->Close();
+
+        stream.frameData->OutputToFile((args.saveDataPath / ("stream_" + to_string(i))).string());
+    }
+}
+
+// Every pick starts one stream further along, so each stream gets a frame per round no matter how many workers there are
+void StreamEngine::Worker()
+{
+    TRACE_THREAD_NAME("Stream Worker");
+    size_t numStreams = streams.size();
+
+    while (remainingStreams > 0)
+    {
+        size_t start = nextStream.fetch_add(1, memory_order_relaxed) % numStreams;
+        Stream* stream = nullptr;
+
+        for (size_t i = 0; i < numStreams && stream == nullptr; i++)
+        {
+            Stream& candidate = *streams[(start + i) % numStreams];
+            bool expected = false;
+
+            if (candidate.finished || !candidate.busy.compare_exchange_strong(expected, true, memory_order_acquire))
+                continue;
+
+            // Another worker may have finished the stream between the check and taking it
+            if (candidate.finished)
+                candidate.busy.store(false, memory_order_release);
+            else
+                stream = &candidate;
+        }
+
+        // More workers than unfinished streams, wait for one to be released
+        if (stream == nullptr)
+        {
+            this_thread::sleep_for(chrono::microseconds(100));
+            continue;
+        }
+
+        ProcessNextFrame(*stream);
+        stream->busy.store(false, memory_order_release);
+    }
+}
+
+void StreamEngine::ProcessNextFrame(Stream& stream)
+{
+    // The queued output still references the last frame, so decode into a new buffer while writing
+    if (stream.outputWriter)
+        stream.frame.release();
+
+    if (!stream.video.Read(stream.frame))
+    {
+        // Only the worker that actually ends the stream counts it off
+        if (!stream.finished.exchange(true))
+        {
+            stream.seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+            remainingStreams--;
+        }
+
+        return;
+    }
+
+    stream.context.decodeTime = chrono::steady_clock::now();
+
+    const SharedStreamData& shared = *stream.shared;
+    FrameRecord frameRecord;
+    frameRecord.frameIndex = stream.frameIndex++;
+
+    ProcessFrame(stream.frame, calibrationData, shared.undistortMapData, shared.viewTransform, stream.context, frameRecord, args.combineStepsInFinalFrame, args.filterInSkyView);
+
+    stream.frameData->Add(frameRecord);
+
+    if (stream.outputWriter)
+        stream.outputWriter->Write(stream.frame, frameRecord);
+}
+
+void StreamEngine::OutputToConsole() const
+{
+    int64 totalFrames = 0;
+
+    for (size_t i = 0; i < streams.size(); i++)
+    {
+        const Stream& stream = *streams[i];
+        totalFrames += stream.frameIndex;
+
+        printf("Stream %zu (%s): %lld frames in %.2f s (%.1f fps)\n", i, stream.videoPath.c_str(),
+            (long long)stream.frameIndex, stream.seconds, stream.frameIndex / max(stream.seconds, 1e-9));
+    }
+
+    printf("All streams: %lld frames in %.2f s (%.1f fps) on %d workers\n", (long long)totalFrames, seconds, totalFrames / max(seconds, 1e-9), args.numWorkers);
+    fflush(stdout);
+}
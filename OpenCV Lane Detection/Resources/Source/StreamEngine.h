@@ -0,0 +1,98 @@
+#pragma once
+
+#include "Calibration.h"
+#include "Undistortion.h"
+#include "ViewTransform.h"
+#include "PipelineContext.h"
+#include "FrameData.h"
+#include "OutputWriter.h"
+#include "FrameSource.h"
+
+#include <atomic>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+
+using namespace std;
+using namespace cv;
+using namespace filesystem;
+
+struct StreamEngineArgs
+{
+    int numWorkers = 1;
+    bool filterInSkyView = false;
+    bool combineStepsInFinalFrame = false;
+    double processingScale = 1.0; // Lane filter and curve fit resolution relative to each video
+    FrameFormat frameFormat = FrameFormat::BGR; // Format asked of the videos, raw YUV files need rawFrameSize
+    Size rawFrameSize;
+    path saveDataPath; // Frame data of stream i goes to saveDataPath/stream_i
+    path outputVideoDirectory, resultsDirectory; // Optional, one file per stream named after the video
+    LaneResultPublisher* resultPublisher = nullptr; // Shared by every stream, the results carry the stream index
+};
+
+// Read-only data shared by every stream with the same frame size, the warp geometry is derived for that size
+struct SharedStreamData
+{
+    PartUndistortMapData undistortMapData;
+    ViewTransformData viewTransform;
+};
+
+// Processes several videos at once in one process, over one pool of worker threads
+// The calibration and the remap tables are built once and shared, every stream keeps its own tracker, buffers and frame data
+// A stream is only ever worked on by one thread at a time, so its frames stay in order for the lane tracker
+class StreamEngine
+{
+public:
+    StreamEngine(const CalibrationData& calibrationData, StreamEngineArgs args);
+    ~StreamEngine();
+
+    StreamEngine(const StreamEngine&) = delete;
+    StreamEngine& operator=(const StreamEngine&) = delete;
+
+    bool AddStream(const string videoPath);
+
+    // Runs every stream to the end of its video, headless and as fast as possible
+    void Run();
+
+    // Frames per second of every stream and of all of them together
+    void OutputToConsole() const;
+
+private:
+    struct Stream
+    {
+        string videoPath;
+        FrameSource video;
+        shared_ptr<const SharedStreamData> shared;
+
+        PipelineContext context;
+        unique_ptr<FrameData> frameData;
+        unique_ptr<OutputWriter> outputWriter;
+        Mat frame;
+
+        int64 frameIndex = 0;
+        double seconds = 0;
+        atomic<bool> busy = false, finished = false;
+    };
+
+    shared_ptr<const SharedStreamData> GetSharedData(Size frameSize);
+
+    void Worker();
+    void ProcessNextFrame(Stream& stream);
+
+    CalibrationData calibrationData;
+    StreamEngineArgs args;
+
+    mutex sharedDataLock;
+    map<pair<int, int>, shared_ptr<const SharedStreamData>> sharedData;
+
+    vector<unique_ptr<Stream>> streams;
+    atomic<size_t> nextStream = 0, remainingStreams = 0;
+    chrono::steady_clock::time_point startTime;
+    double seconds = 0;
+};
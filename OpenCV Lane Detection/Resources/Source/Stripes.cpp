@@ -0,0 +1,79 @@
+#include "Stripes.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <vector>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static size_t DetectL2CacheSize()
+{
+#ifdef _WIN32
+    DWORD length = 0;
+    GetLogicalProcessorInformation(nullptr, &length);
+
+    vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+
+    if (!infos.empty() && GetLogicalProcessorInformation(infos.data(), &length))
+        for (const SYSTEM_LOGICAL_PROCESSOR_INFORMATION& info : infos)
+            if (info.Relationship == RelationCache && info.Cache.Level == 2 && info.Cache.Type != CacheInstruction)
+                return info.Cache.Size;
+#else
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+
+    if (size > 0)
+        return (size_t)size;
+#endif
+
+    // glibc doesn't know the caches of most ARM cores, sysfs does
+    for (int index = 0; index < 8; index++)
+    {
+        string directory = "/sys/devices/system/cpu/cpu0/cache/index" + to_string(index) + "/";
+        ifstream levelFile(directory + "level"), typeFile(directory + "type"), sizeFile(directory + "size");
+        int level = 0;
+        string type, size;
+
+        if (!(levelFile >> level) || !(typeFile >> type) || !(sizeFile >> size))
+            break;
+
+        if (level != 2 || type == "Instruction" || size.empty())
+            continue;
+
+        size_t value = (size_t)stoull(size);
+        char unit = size.back();
+
+        return unit == 'K' ? value << 10 : unit == 'M' ? value << 20 : value;
+    }
+#endif
+
+    return 0;
+}
+
+size_t L2CacheSize()
+{
+    static const size_t size = []()
+    {
+        size_t detected = DetectL2CacheSize();
+        return detected > 0 ? detected : (size_t)1 << 20;
+    }();
+
+    return size;
+}
+
+int StripeRows(size_t bytesPerRow, int haloRows, int minRows, int maxRows)
+{
+    size_t budget = L2CacheSize() / 2;
+    int rows = (int)(budget / max(bytesPerRow, (size_t)1)) - 2 * haloRows;
+
+    return max(min(rows, maxRows), min(minRows, maxRows));
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+
+// Size of the L2 cache of the first core, detected once, 1MB if the system doesn't say
+size_t L2CacheSize();
+
+// Rows per stripe so that a stripe of bytesPerRow rows plus haloRows on each side fits in half of the L2 cache
+// The other half is left to the tables, the row rings and whatever the other hyperthread is doing
+int StripeRows(size_t bytesPerRow, int haloRows, int minRows, int maxRows);
@@ -0,0 +1,362 @@
+#include "SyntheticRoad.h"
+#include "FrameSource.h"
+
+#include <cfloat>
+#include <cmath>
+#include <fstream>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+static const char* const LensNames[] = { "none", "barrel", "pincushion", "wide" };
+
+bool ParseSyntheticLens(const string& name, SyntheticLens& lens)
+{
+	for (int i = 0; i < 4; i++)
+		if (name == LensNames[i])
+		{
+			lens = (SyntheticLens)i;
+			return true;
+		}
+
+	return false;
+}
+
+const char* SyntheticLensName(SyntheticLens lens)
+{
+	return LensNames[(int)lens];
+}
+
+CalibrationData SyntheticCalibration(Size frameSize, SyntheticLens lens)
+{
+	CalibrationData calibrationData;
+	double focalLength = (lens == SyntheticLens::WideAngle ? 0.6 : 0.9) * frameSize.width;
+	double k1 = 0, k2 = 0;
+
+	switch (lens)
+	{
+	case SyntheticLens::Barrel: k1 = -0.12; k2 = 0.02; break;
+	case SyntheticLens::Pincushion: k1 = 0.08; break;
+	case SyntheticLens::WideAngle: k1 = -0.3; k2 = 0.08; break;
+	default: break;
+	}
+
+	calibrationData.camMatrix = (Mat_<double>(3, 3) <<
+		focalLength, 0, frameSize.width * 0.5,
+		0, focalLength, frameSize.height * 0.5,
+		0, 0, 1);
+	calibrationData.distortion = (Mat_<double>(1, 5) << k1, k2, 0, 0, 0);
+
+	return calibrationData;
+}
+
+SyntheticCamera CreateSyntheticCamera(Size frameSize, const CalibrationData& calibrationData)
+{
+	int w = frameSize.width, h = frameSize.height;
+	LaneGeometry geometry = CalculateLaneGeometry(frameSize);
+
+	SyntheticCamera camera;
+	camera.frameSize = frameSize;
+	camera.calibrationData = calibrationData;
+
+	// Raw pixel -> undistorted pixel, through the same camera matrix the undistortion maps keep
+	Mat rawPoints(1, w * h, CV_32FC2), undistortedPoints;
+	Point2f* rawPtr = rawPoints.ptr<Point2f>(0);
+
+	for (int y = 0; y < h; y++)
+		for (int x = 0; x < w; x++)
+			rawPtr[(size_t)y * w + x] = Point2f((float)x, (float)y);
+
+	undistortPoints(rawPoints, undistortedPoints, calibrationData.camMatrix, calibrationData.distortion, noArray(), calibrationData.camMatrix);
+	camera.undistortMap = undistortedPoints.reshape(2, h);
+
+	// Undistorted pixel -> sky view pixel
+	perspectiveTransform(camera.undistortMap, camera.roadMap, getPerspectiveTransform(geometry.sourcePoints, geometry.destinationPoints));
+
+	// Only the pixels below the horizon show the road, the homography folds the sky back onto the plane
+	float horizon = geometry.sourcePoints[0].y;
+
+	for (int y = 0; y < h; y++)
+	{
+		const Point2f* undistortedRow = camera.undistortMap.ptr<Point2f>(y);
+		Point2f* roadRow = camera.roadMap.ptr<Point2f>(y);
+
+		for (int x = 0; x < w; x++)
+			if (undistortedRow[x].y <= horizon)
+				roadRow[x] = Point2f(-1, -1);
+	}
+
+	return camera;
+}
+
+// Radius and vehicle position as UpdateLaneGeometry defines them, from the exact curves instead of fitted ones
+static void SetLaneResults(SyntheticLanes& lanes, Size frameSize)
+{
+	LaneGeometry geometry = CalculateLaneGeometry(frameSize);
+	double metersPerPixelX = geometry.metersPerPixelX, metersPerPixelY = geometry.metersPerPixelY;
+	double y = frameSize.width * metersPerPixelX, bottom = frameSize.height - 1;
+
+	auto radius = [&](const Mat& K)
+	{
+		double a = K.at<float>(2) * metersPerPixelX / (metersPerPixelY * metersPerPixelY);
+		double b = K.at<float>(1) * metersPerPixelX / metersPerPixelY;
+
+		return a != 0 ? (float)(pow(1 + pow(2 * a * y + b, 2), 1.5) / abs(2 * a)) : FLT_MAX;
+	};
+
+	auto bottomX = [&](const Mat& K)
+	{
+		return (K.at<float>(2) * bottom + K.at<float>(1)) * bottom + K.at<float>(0);
+	};
+
+	lanes.leftRadius = radius(lanes.leftPixelK);
+	lanes.rightRadius = radius(lanes.rightPixelK);
+	lanes.vehiclePosition = (float)(((bottomX(lanes.leftPixelK) + bottomX(lanes.rightPixelK)) / 2 - frameSize.width / 2) * metersPerPixelX);
+}
+
+void SyntheticRoadFrame(Mat& out, const SyntheticCamera& camera, int frameIndex, SyntheticLanes* lanes)
+{
+	Size frameSize = camera.frameSize;
+	int w = frameSize.width, h = frameSize.height;
+	LaneGeometry geometry = CalculateLaneGeometry(frameSize);
+	const vector<Point2f>& sourcePoints = geometry.sourcePoints;
+	const vector<Point2f>& destinationPoints = geometry.destinationPoints;
+
+	// Lanes in sky view, offset by bend * w * u^2 where u goes from 0 at the car to 1 at the top
+	// The whole road shifts sideways as the car drifts within its lane
+	double bend = 0.06 * sin(frameIndex * 0.02);
+	double drift = 0.03 * w * sin(frameIndex * 0.011);
+	double a = bend * w / ((double)h * h), b = -2.0 * bend * w / h, c = bend * w + drift;
+	double leftX = destinationPoints[0].x, rightX = destinationPoints[3].x;
+
+	if (lanes != nullptr)
+	{
+		lanes->leftPixelK = (Mat_<float>(3, 1) << (float)(leftX + c), (float)b, (float)a);
+		lanes->rightPixelK = (Mat_<float>(3, 1) << (float)(rightX + c), (float)b, (float)a);
+		SetLaneResults(*lanes, frameSize);
+	}
+
+	// Paint the road in sky view, a solid yellow line on the left and a dashed white line on the right
+	Mat skyView(frameSize, CV_8UC3, Scalar(95, 95, 95));
+	int lineWidth = max(2, w / 80), dashLength = max(4, h / 8);
+	int dashPhase = (frameIndex * max(1, h / 90)) % (2 * dashLength);
+	vector<Point> leftLine, rightLine;
+
+	for (int y = 0; y < h; y++)
+	{
+		double offset = (a * y + b) * y + c;
+		leftLine.push_back(Point((int)lround(leftX + offset), y));
+		rightLine.push_back(Point((int)lround(rightX + offset), y));
+	}
+
+	polylines(skyView, leftLine, false, Scalar(0, 200, 255), lineWidth, LINE_AA);
+
+	for (int y = 0; y < h; y++)
+		if ((y + dashPhase) % (2 * dashLength) == 0)
+		{
+			int end = min(h, y + dashLength);
+			vector<Point> dash(rightLine.begin() + y, rightLine.begin() + end);
+			polylines(skyView, dash, false, Scalar(230, 230, 230), lineWidth, LINE_AA);
+		}
+
+	// Sky above the horizon and grass next to the road
+	out.create(frameSize, CV_8UC3);
+	out.setTo(Scalar(70, 120, 60));
+	out.rowRange(0, min(h, (int)sourcePoints[0].y)).setTo(Scalar(200, 160, 120));
+
+	// Raw pixel -> undistorted pixel -> sky view pixel, so that the rendered frame carries the lens distortion
+	remap(skyView, out, camera.roadMap, noArray(), INTER_LINEAR, BORDER_TRANSPARENT);
+
+	// Deterministic sensor noise
+	RNG rng(0x5eed + frameIndex);
+	Mat noise(frameSize, CV_8UC3);
+	rng.fill(noise, RNG::UNIFORM, 0, 12);
+	add(out, noise, out);
+}
+
+void SyntheticRoadFrame(Mat& out, Size frameSize, const CalibrationData& calibrationData, int frameIndex, SyntheticLanes* lanes)
+{
+	SyntheticRoadFrame(out, CreateSyntheticCamera(frameSize, calibrationData), frameIndex, lanes);
+}
+
+void SyntheticChessboards(vector<Mat>& out, const SyntheticCamera& camera, Size boardSize, int count)
+{
+	Size frameSize = camera.frameSize;
+	out.resize(count);
+
+	// The board in units of squares, with a white square wide quiet zone around it
+	float boardWidth = (float)(boardSize.width + 1), boardHeight = (float)(boardSize.height + 1);
+	vector<Point2f> boardCorners = { Point2f(0, 0), Point2f(boardWidth, 0), Point2f(boardWidth, boardHeight), Point2f(0, boardHeight) };
+
+	for (int i = 0; i < count; i++)
+	{
+		// Each view moves the board around the frame and tilts it a different way, the tilt is what pins down the focal length
+		double t = 2 * CV_PI * i / count;
+		Point2f center((float)(frameSize.width * (0.5 + 0.12 * cos(t))), (float)(frameSize.height * (0.5 + 0.1 * sin(t))));
+		float squareSize = (float)(0.5 * frameSize.height / boardHeight);
+		float tiltX = (float)(0.25 * sin(t)), tiltY = (float)(0.25 * cos(t)), angle = (float)(0.2 * sin(2 * t));
+
+		vector<Point2f> viewCorners;
+
+		for (const Point2f& corner : boardCorners)
+		{
+			// Keystone the square board so that one side of it looks closer, then rotate it
+			float u = corner.x / boardWidth - 0.5f, v = corner.y / boardHeight - 0.5f;
+			float x = u * boardWidth * squareSize * (1 + 2 * tiltY * v), y = v * boardHeight * squareSize * (1 + 2 * tiltX * u);
+
+			viewCorners.push_back(center + Point2f(x * cos(angle) - y * sin(angle), x * sin(angle) + y * cos(angle)));
+		}
+
+		// Raw pixel -> undistorted pixel -> position on the board
+		Mat boardMap;
+		perspectiveTransform(camera.undistortMap, boardMap, getPerspectiveTransform(viewCorners, boardCorners));
+
+		Mat& image = out[i];
+		image.create(frameSize, CV_8UC3);
+
+		for (int y = 0; y < frameSize.height; y++)
+		{
+			const Point2f* boardRow = boardMap.ptr<Point2f>(y);
+			Vec3b* imageRow = image.ptr<Vec3b>(y);
+
+			for (int x = 0; x < frameSize.width; x++)
+			{
+				// The inner corners land on the whole square positions from 1 to boardSize
+				Point2f p = boardRow[x];
+				bool onBoard = p.x >= 0 && p.y >= 0 && p.x < boardWidth && p.y < boardHeight;
+				bool inQuietZone = p.x >= -1 && p.y >= -1 && p.x < boardWidth + 1 && p.y < boardHeight + 1;
+				bool black = onBoard && (((int)floor(p.x) + (int)floor(p.y)) & 1) == 0;
+
+				if (!inQuietZone)
+					imageRow[x] = Vec3b(90, 110, 100);
+				else
+					imageRow[x] = black ? Vec3b(20, 20, 20) : Vec3b(235, 235, 235);
+			}
+		}
+	}
+}
+
+double SyntheticCalibrationRoundTrip(const SyntheticCamera& camera, CalibrationData& recovered)
+{
+	Size boardSize(9, 6);
+	vector<Mat> boards;
+	SyntheticChessboards(boards, camera, boardSize, 16);
+
+	recovered = Calibrate(boards, boardSize, 1.0f);
+
+	if (recovered.camMatrix.empty())
+		return -1;
+
+	// Undistort a grid of raw pixels with both calibrations, into the pixels of the true camera so the distances compare
+	vector<Point2f> rawPoints, trueUndistorted, recoveredUndistorted;
+	int step = max(8, camera.frameSize.width / 64);
+
+	for (int y = 0; y < camera.frameSize.height; y += step)
+		for (int x = 0; x < camera.frameSize.width; x += step)
+			rawPoints.push_back(Point2f((float)x, (float)y));
+
+	const Mat& trueCamMatrix = camera.calibrationData.camMatrix;
+	undistortPoints(rawPoints, trueUndistorted, trueCamMatrix, camera.calibrationData.distortion, noArray(), trueCamMatrix);
+	undistortPoints(rawPoints, recoveredUndistorted, recovered.camMatrix, recovered.distortion, noArray(), trueCamMatrix);
+
+	double error = 0;
+
+	for (size_t i = 0; i < rawPoints.size(); i++)
+		error += norm(trueUndistorted[i] - recoveredUndistorted[i]);
+
+	return error / max<size_t>(rawPoints.size(), 1);
+}
+
+static string TruthPath(const string videoPath)
+{
+	return videoPath + ".truth.yml";
+}
+
+bool WriteSyntheticRoadVideo(const string videoPath, Size frameSize, int frames, SyntheticLens lens, double fps)
+{
+	CalibrationData calibrationData = SyntheticCalibration(frameSize, lens);
+	SyntheticCamera camera = CreateSyntheticCamera(frameSize, calibrationData);
+
+	string extension = filesystem::path(videoPath).extension().string();
+	bool raw = extension == ".nv12";
+	ofstream rawFile;
+	VideoWriter videoWriter;
+
+	if (raw)
+	{
+		// NV12 halves the chroma, so the frame size has to be even
+		if (frameSize.width % 2 != 0 || frameSize.height % 2 != 0)
+			return false;
+
+		rawFile.open(videoPath, ios::binary);
+	}
+	else
+	{
+		int fourcc = extension == ".avi" ? VideoWriter::fourcc('M', 'J', 'P', 'G') : VideoWriter::fourcc('m', 'p', '4', 'v');
+		videoWriter.open(videoPath, fourcc, fps, frameSize);
+	}
+
+	FileStorage truthFile(TruthPath(videoPath), FileStorage::WRITE);
+
+	if ((raw ? !rawFile.is_open() : !videoWriter.isOpened()) || !truthFile.isOpened())
+		return false;
+
+	truthFile << "frameSize" << frameSize << "fps" << fps << "lens" << SyntheticLensName(lens) <<
+		"camMatrix" << calibrationData.camMatrix << "distortion" << calibrationData.distortion;
+	truthFile << "frames" << "[";
+
+	Mat frame, nv12Frame;
+	SyntheticLanes lanes;
+
+	for (int i = 0; i < frames; i++)
+	{
+		SyntheticRoadFrame(frame, camera, i, &lanes);
+
+		if (raw)
+		{
+			ConvertBGRToNV12(frame, nv12Frame);
+			rawFile.write((const char*)nv12Frame.data, nv12Frame.total());
+		}
+		else
+			videoWriter.write(frame);
+
+		truthFile << "{" << "leftK" << lanes.leftPixelK << "rightK" << lanes.rightPixelK <<
+			"leftRadius" << lanes.leftRadius << "rightRadius" << lanes.rightRadius << "vehiclePosition" << lanes.vehiclePosition << "}";
+	}
+
+	truthFile << "]";
+
+	return true;
+}
+
+bool LoadSyntheticTruth(const string videoPath, SyntheticTruth& truth)
+{
+	FileStorage truthFile(TruthPath(videoPath), FileStorage::READ);
+
+	if (!truthFile.isOpened())
+		return false;
+
+	string lens;
+
+	truthFile["frameSize"] >> truth.frameSize;
+	truthFile["lens"] >> lens;
+	truthFile["camMatrix"] >> truth.calibrationData.camMatrix;
+	truthFile["distortion"] >> truth.calibrationData.distortion;
+	ParseSyntheticLens(lens, truth.lens);
+
+	truth.lanes.clear();
+
+	for (const FileNode& node : truthFile["frames"])
+	{
+		SyntheticLanes lanes;
+
+		node["leftK"] >> lanes.leftPixelK;
+		node["rightK"] >> lanes.rightPixelK;
+		node["leftRadius"] >> lanes.leftRadius;
+		node["rightRadius"] >> lanes.rightRadius;
+		node["vehiclePosition"] >> lanes.vehiclePosition;
+
+		truth.lanes.push_back(lanes);
+	}
+
+	return !truth.lanes.empty() && !truth.calibrationData.camMatrix.empty();
+}
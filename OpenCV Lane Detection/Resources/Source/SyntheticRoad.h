@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Calibration.h"
+#include "LaneGeometry.h"
+
+#include <string>
+#include <opencv2/core.hpp>
+
+using namespace std;
+using namespace cv;
+
+// Lens distortions the synthetic camera can be rendered with
+enum class SyntheticLens
+{
+	None,
+	Barrel, // Mild barrel distortion of a typical dashboard camera
+	Pincushion,
+	WideAngle // Strong barrel distortion with a shorter focal length
+};
+
+bool ParseSyntheticLens(const string& name, SyntheticLens& lens);
+const char* SyntheticLensName(SyntheticLens lens);
+
+// Ground truth of a synthetic road frame, x = a*y^2 + b*y + c in sky view pixels of the frame size
+// The radii and the vehicle position follow the definitions of the curve fit, so they compare directly with its results
+struct SyntheticLanes
+{
+	Mat leftPixelK, rightPixelK; // (c, b, a) as 3x1 CV_32F, the same layout as CurveFitData
+	float leftRadius = 0, rightRadius = 0, vehiclePosition = 0;
+};
+
+// The camera a synthetic road is seen through, with the raw pixel -> sky view lookup that every frame is rendered with
+struct SyntheticCamera
+{
+	Size frameSize;
+	CalibrationData calibrationData;
+	Mat undistortMap; // Raw pixel -> undistorted pixel (CV_32FC2)
+	Mat roadMap; // Raw pixel -> sky view pixel, (-1, -1) above the horizon (CV_32FC2)
+};
+
+// Camera with the lens distortion, scaled to the frame size
+CalibrationData SyntheticCalibration(Size frameSize, SyntheticLens lens = SyntheticLens::Barrel);
+SyntheticCamera CreateSyntheticCamera(Size frameSize, const CalibrationData& calibrationData);
+
+// Renders a deterministic road frame as the distorted camera would see it through the lane geometry's warp points
+// The lanes bend, the car drifts across the lane and the dashes move with the frame index
+void SyntheticRoadFrame(Mat& out, const SyntheticCamera& camera, int frameIndex, SyntheticLanes* lanes = nullptr);
+void SyntheticRoadFrame(Mat& out, Size frameSize, const CalibrationData& calibrationData, int frameIndex, SyntheticLanes* lanes = nullptr);
+
+// Chessboard views at different poses through the camera's lens, boardSize counts the inner corners like Calibrate
+void SyntheticChessboards(vector<Mat>& out, const SyntheticCamera& camera, Size boardSize, int count);
+
+// Calibrates from the camera's chessboard views with Calibrate, as a real camera would be
+// Returns the mean distance in pixels between where the true and the recovered calibration undistort the same raw pixels, -1 if no board was found
+double SyntheticCalibrationRoundTrip(const SyntheticCamera& camera, CalibrationData& recovered);
+
+// A rendered road video with the ground truth of every frame, stored next to the video as <video>.truth.yml
+struct SyntheticTruth
+{
+	Size frameSize;
+	SyntheticLens lens = SyntheticLens::Barrel;
+	CalibrationData calibrationData;
+	vector<SyntheticLanes> lanes;
+};
+
+// Raw .nv12 paths are written as raw frames, anything else through a VideoWriter
+bool WriteSyntheticRoadVideo(const string videoPath, Size frameSize, int frames, SyntheticLens lens, double fps = 30);
+bool LoadSyntheticTruth(const string videoPath, SyntheticTruth& truth);
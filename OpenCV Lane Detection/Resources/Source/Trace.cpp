@@ -0,0 +1,151 @@
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+atomic<bool> tracingEnabled = false;
+
+// Events kept per thread, 32 bytes each
+static const size_t TraceBufferCapacity = 1 << 16;
+
+struct TraceEvent
+{
+    const char* name;
+    int64_t start, duration;
+    int64_t frameIndex;
+};
+
+// Written by its own thread only, the exporter copies it while it's being written and drops what was overwritten in the meantime
+struct TraceBuffer
+{
+    vector<TraceEvent> events = vector<TraceEvent>(TraceBufferCapacity);
+    atomic<uint64_t> written = 0;
+    atomic<const char*> threadName = nullptr;
+    int64_t frameIndex = -1;
+    int threadId = 0;
+};
+
+// Buffers are registered once per thread and kept until the process exits, so the events of finished threads can still be exported
+static mutex traceBuffersLock;
+static vector<unique_ptr<TraceBuffer>> traceBuffers;
+static const int64_t traceEpoch = TraceClock();
+
+// The buffer of a thread is only created with its first event, threads that never record while tracing is on cost nothing
+static thread_local TraceBuffer* threadTraceBuffer = nullptr;
+static thread_local const char* threadTraceName = nullptr;
+
+static TraceBuffer& ThreadTraceBuffer()
+{
+    if (threadTraceBuffer == nullptr)
+    {
+        lock_guard<mutex> guard(traceBuffersLock);
+
+        traceBuffers.push_back(make_unique<TraceBuffer>());
+        threadTraceBuffer = traceBuffers.back().get();
+        threadTraceBuffer->threadId = (int)traceBuffers.size();
+        threadTraceBuffer->threadName.store(threadTraceName, memory_order_release);
+    }
+
+    return *threadTraceBuffer;
+}
+
+void EnableTracing(bool enabled)
+{
+    tracingEnabled.store(enabled, memory_order_relaxed);
+}
+
+void SetTraceThreadName(const char* name)
+{
+    threadTraceName = name;
+
+    if (threadTraceBuffer != nullptr)
+        threadTraceBuffer->threadName.store(name, memory_order_release);
+}
+
+void SetTraceFrame(int64_t frameIndex)
+{
+    if (tracingEnabled.load(memory_order_relaxed))
+        ThreadTraceBuffer().frameIndex = frameIndex;
+}
+
+void RecordTraceEvent(const char* name, int64_t start, int64_t duration)
+{
+    TraceBuffer& buffer = ThreadTraceBuffer();
+    uint64_t index = buffer.written.load(memory_order_relaxed);
+
+    buffer.events[index % TraceBufferCapacity] = { name, start, duration, buffer.frameIndex };
+    buffer.written.store(index + 1, memory_order_release);
+}
+
+bool ExportTrace(const string path)
+{
+    FILE* file = fopen(path.c_str(), "w");
+
+    if (file == nullptr)
+        return false;
+
+    vector<TraceBuffer*> buffers;
+    {
+        lock_guard<mutex> guard(traceBuffersLock);
+
+        for (const unique_ptr<TraceBuffer>& buffer : traceBuffers)
+            buffers.push_back(buffer.get());
+    }
+
+    vector<TraceEvent> events;
+    bool first = true;
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", file);
+
+    auto separator = [&]()
+    {
+        if (!first)
+            fputs(",\n", file);
+
+        first = false;
+    };
+
+    for (TraceBuffer* buffer : buffers)
+    {
+        const char* threadName = buffer->threadName.load(memory_order_acquire);
+
+        separator();
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+            buffer->threadId, threadName != nullptr ? threadName : "Thread", buffer->threadId);
+
+        // Copy the newest events, then keep only those the thread can't have overwritten during the copy
+        uint64_t end = buffer->written.load(memory_order_acquire);
+        uint64_t begin = end > TraceBufferCapacity ? end - TraceBufferCapacity : 0;
+
+        events.resize((size_t)(end - begin));
+
+        for (uint64_t i = begin; i < end; i++)
+            events[(size_t)(i - begin)] = buffer->events[i % TraceBufferCapacity];
+
+        // The thread may be halfway through event written, whose slot still holds event written - capacity
+        uint64_t written = buffer->written.load(memory_order_acquire);
+        uint64_t intact = written + 1 > TraceBufferCapacity ? written + 1 - TraceBufferCapacity : 0;
+
+        for (uint64_t i = max(begin, intact); i < end; i++)
+        {
+            const TraceEvent& event = events[(size_t)(i - begin)];
+
+            // Complete events in microseconds with nanosecond decimals, nesting follows from the times
+            separator();
+            fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                event.name, buffer->threadId, (event.start - traceEpoch) / 1e3, event.duration / 1e3);
+
+            if (event.frameIndex >= 0)
+                fprintf(file, ",\"args\":{\"frame\":%lld}", (long long)event.frameIndex);
+
+            fputs("}", file);
+        }
+    }
+
+    fputs("\n]}\n", file);
+
+    return fclose(file) == 0;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+// Timeline of scoped stages on every thread, exported in the Chrome trace format (chrome://tracing, ui.perfetto.dev)
+// Builds without LANE_TRACE compile the TRACE_ macros away, otherwise recording is off until EnableTracing(true)
+// Each thread records into its own fixed ring of events, so recording never locks and only the newest events are kept
+
+extern atomic<bool> tracingEnabled;
+
+void EnableTracing(bool enabled);
+// Names the calling thread in the exported timeline
+void SetTraceThreadName(const char* name);
+// Frame the calling thread is working on, attached to the events it records until changed, -1 for none
+void SetTraceFrame(int64_t frameIndex);
+// Writes the events recorded so far, can be called at any time while the threads keep recording
+bool ExportTrace(const string path);
+
+// Nanoseconds on the steady clock
+inline int64_t TraceClock()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void RecordTraceEvent(const char* name, int64_t start, int64_t duration);
+
+// Records the time from construction to destruction, name has to outlive the export, a string literal in practice
+class TraceScope
+{
+public:
+    TraceScope(const char* name) : name(tracingEnabled.load(memory_order_relaxed) ? name : nullptr), start(this->name != nullptr ? TraceClock() : 0)
+    {
+    }
+
+    ~TraceScope()
+    {
+        if (name != nullptr)
+            RecordTraceEvent(name, start, TraceClock() - start);
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    int64_t start;
+};
+
+// Times the stages of a frame one after the other for the FrameRecord, each stage also goes into the trace
+class StageTimer
+{
+public:
+    void Start(const char* stageName)
+    {
+        name = stageName;
+        start = TraceClock();
+    }
+
+    // Seconds since Start
+    double Stop()
+    {
+        int64_t duration = TraceClock() - start;
+
+#ifdef LANE_TRACE
+        if (tracingEnabled.load(memory_order_relaxed))
+            RecordTraceEvent(name, start, duration);
+#endif
+
+        return duration * 1e-9;
+    }
+
+private:
+    const char* name = nullptr;
+    int64_t start = 0;
+};
+
+#ifdef LANE_TRACE
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) SetTraceThreadName(name)
+#define TRACE_FRAME(frameIndex) SetTraceFrame(frameIndex)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#define TRACE_FRAME(frameIndex) ((void)0)
+#endif
@@ -2,12 +2,17 @@
 
 #include <opencv2/imgproc.hpp>
 
+int UndistortMapPartRows(const Size imageSize)
+{
+    return min(max(1, (1 << 12) / max(imageSize.width, 1)), imageSize.height);
+}
+
 // This function is a modified version of cv::undistort which calculates all of the rectify maps and outputs them
 void CalculatePartUndistortMaps(PartUndistortMapData& undistortMapDataOut, const Size imageSize, const CalibrationData& calibrationData)
 {
     Mat distCoeffs = calibrationData.distortion, cameraMatrix = calibrationData.camMatrix;
 
-    int stripe_size0 = min(max(1, (1 << 12) / max(imageSize.width, 1)), imageSize.height);
+    int stripe_size0 = UndistortMapPartRows(imageSize);
     Mat map1(stripe_size0, imageSize.width, CV_16SC2), map2(stripe_size0, imageSize.width, CV_16UC1);
 
     Mat_<float> A, Ar, I = Mat_<float>::eye(3, 3);
@@ -37,12 +42,21 @@ void CalculatePartUndistortMaps(PartUndistortMapData& undistortMapDataOut, const
 void RemapFrame(const Mat& frame, Mat& out, const CalibrationData& calibrationData, const PartUndistortMapData& undistortMapData)
 {
     out.create(frame.size(), frame.type());
-    int stripe_size0 = std::min(max(1, (1 << 12) / max(frame.cols, 1)), frame.rows);
+    int stripe_size0 = UndistortMapPartRows(frame.size());
 
-    for (int y = 0, i = 0; y < frame.rows; y += stripe_size0, i++)
+    // The parts are only a few rows each, remapping them one after the other started a parallel loop per handful of rows
+    // Running the parts themselves in parallel keeps each remap on one core, where its rows and table part stay in cache
+    int parts = (int)undistortMapData.map1_parts.size();
+    CV_Assert(parts == (frame.rows + stripe_size0 - 1) / stripe_size0);
+
+    parallel_for_(Range(0, parts), [&](const Range& range)
     {
-        int stripe_size = min(stripe_size0, frame.rows - y);
-        Mat dst_part = out.rowRange(y, y + stripe_size);
-        remap(frame, dst_part, undistortMapData.map1_parts.at(i), undistortMapData.map2_parts.at(i), INTER_LINEAR, BORDER_CONSTANT);
-    }
+        for (int i = range.start; i < range.end; i++)
+        {
+            int y = i * stripe_size0;
+            int stripe_size = min(stripe_size0, frame.rows - y);
+            Mat dst_part = out.rowRange(y, y + stripe_size);
+            remap(frame, dst_part, undistortMapData.map1_parts[i], undistortMapData.map2_parts[i], INTER_LINEAR, BORDER_CONSTANT);
+        }
+    });
 }
\ No newline at end of file
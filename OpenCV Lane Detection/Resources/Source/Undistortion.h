@@ -2,6 +2,7 @@
 
 #include "Calibration.h"
 
+#include <memory>
 #include <opencv2/core.hpp>
 
 using namespace std;
@@ -10,7 +11,10 @@ using namespace cv;
 struct PartUndistortMapData
 {
     vector<Mat> map1_parts, map2_parts;
+    shared_ptr<const void> mappedFile; // Keeps the cache file mapped while the parts point into it
 };
 
+// Rows of every map part but the last, which takes the rest of the frame
+int UndistortMapPartRows(const Size imageSize);
 void CalculatePartUndistortMaps(PartUndistortMapData& undistortMapDataOut, const Size imageSize, const CalibrationData& calibrationData);
 void RemapFrame(const Mat& frame, Mat& out, const CalibrationData& calibrationData, const PartUndistortMapData& undistortMapData);
\ No newline at end of file
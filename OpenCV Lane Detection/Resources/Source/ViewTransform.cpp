@@ -0,0 +1,77 @@
+#include "ViewTransform.h"
+
+#include <opencv2/imgproc.hpp>
+
+void CalculateViewTransform(ViewTransformData& viewTransformOut, const Size frameSize, const CalibrationData& calibrationData, const vector<Point2f>& sourcePoints, const vector<Point2f>& destinationPoints)
+{
+    CalculateViewTransform(viewTransformOut, frameSize, Rect(Point(0, 0), frameSize), calibrationData, sourcePoints, destinationPoints);
+}
+
+// Builds one remap table that goes straight from the raw frame to the sky view
+// Only the pixels that land inside viewRect are ever sampled, so the sky above the horizon is never touched
+void CalculateViewTransform(ViewTransformData& viewTransformOut, const Size frameSize, const Rect viewRect, const CalibrationData& calibrationData, const vector<Point2f>& sourcePoints, const vector<Point2f>& destinationPoints)
+{
+    viewTransformOut.frameSize = frameSize;
+    viewTransformOut.viewRect = viewRect;
+    viewTransformOut.viewSize = viewRect.size();
+
+    viewTransformOut.warpMatrix = getPerspectiveTransform(sourcePoints, destinationPoints);
+    viewTransformOut.inverseWarpMatrix = getPerspectiveTransform(destinationPoints, sourcePoints);
+    viewTransformOut.outputSize = frameSize;
+    viewTransformOut.outputInverseWarpMatrix = viewTransformOut.inverseWarpMatrix;
+
+    // Undistorted pixel -> raw pixel lookup for the whole frame, kept in floating point so it can be resampled below
+    Mat undistortMapX, undistortMapY;
+    initUndistortRectifyMap(calibrationData.camMatrix, calibrationData.distortion, Mat(), calibrationData.camMatrix,
+        frameSize, CV_32FC1, undistortMapX, undistortMapY);
+
+    // Sky view pixel -> undistorted pixel through the inverse homography
+    Size viewSize = viewTransformOut.viewSize;
+    Mat viewMapX(viewSize, CV_32FC1), viewMapY(viewSize, CV_32FC1);
+    Matx33d H = viewTransformOut.inverseWarpMatrix;
+
+    for (int i = 0; i < viewSize.height; i++)
+    {
+        float* xRowPtr = viewMapX.ptr<float>(i);
+        float* yRowPtr = viewMapY.ptr<float>(i);
+        double y = i + viewRect.y;
+
+        for (int j = 0; j < viewSize.width; j++)
+        {
+            double x = j + viewRect.x;
+            double w = H(2, 0) * x + H(2, 1) * y + H(2, 2);
+            w = w != 0 ? 1.0 / w : 0.0;
+
+            xRowPtr[j] = (float)((H(0, 0) * x + H(0, 1) * y + H(0, 2)) * w);
+            yRowPtr[j] = (float)((H(1, 0) * x + H(1, 1) * y + H(1, 2)) * w);
+        }
+    }
+
+    // Compose the two mappings, anything that falls outside of the frame is pushed out of bounds so it stays black
+    Mat composedX, composedY;
+    remap(undistortMapX, composedX, viewMapX, viewMapY, INTER_LINEAR, BORDER_CONSTANT, Scalar(-1));
+    remap(undistortMapY, composedY, viewMapX, viewMapY, INTER_LINEAR, BORDER_CONSTANT, Scalar(-1));
+
+    convertMaps(composedX, composedY, viewTransformOut.map1, viewTransformOut.map2, CV_16SC2);
+}
+
+void CalculateProcessingViewTransform(ViewTransformData& viewTransformOut, const Size frameSize, const Size processingSize, bool filterInSkyView, const CalibrationData& calibrationData)
+{
+    LaneGeometry frameGeometry = CalculateLaneGeometry(frameSize);
+    LaneGeometry processingGeometry = CalculateLaneGeometry(processingSize);
+    Rect viewRect = filterInSkyView ? processingGeometry.skyViewRect : Rect(Point(0, 0), processingSize);
+
+    // The frame is scaled down before it's sampled, so the camera is the one seen at the processing resolution
+    CalculateViewTransform(viewTransformOut, processingSize, viewRect, ScaleCalibration(calibrationData, frameSize, processingSize),
+        processingGeometry.sourcePoints, processingGeometry.destinationPoints);
+
+    // The lane is projected from the processing sky view straight onto the full size output frame
+    viewTransformOut.outputSize = frameSize;
+    viewTransformOut.outputInverseWarpMatrix = getPerspectiveTransform(processingGeometry.destinationPoints, frameGeometry.sourcePoints);
+}
+
+// Undistorts and warps the raw frame into sky view in a single resampling pass
+void ViewTransformFrame(const Mat& frame, Mat& out, const ViewTransformData& viewTransform, int interpolation)
+{
+    remap(frame, out, viewTransform.map1, viewTransform.map2, interpolation, BORDER_CONSTANT);
+}
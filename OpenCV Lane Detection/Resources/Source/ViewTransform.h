@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Calibration.h"
+#include "LaneGeometry.h"
+
+#include <memory>
+#include <opencv2/core.hpp>
+
+using namespace std;
+using namespace cv;
+
+// Precomputed raw frame -> sky view mapping that combines the lens undistortion with the perspective warp
+struct ViewTransformData
+{
+    Mat map1, map2; // Fixed point remap table (CV_16SC2 + CV_16UC1) sampling the raw, distorted frame
+    Mat warpMatrix, inverseWarpMatrix; // Undistorted frame <-> sky view homographies
+    Size frameSize, viewSize; // frameSize is the processing resolution, which can be below the video resolution
+    Size outputSize; // Resolution of the video the lane is projected back onto
+    Mat outputInverseWarpMatrix; // Sky view -> undistorted frame at the output resolution
+    Rect viewRect; // Region of the sky view plane covered by the remap table
+    shared_ptr<const void> mappedFile; // Keeps the cache file mapped while the remap table points into it
+};
+
+void CalculateViewTransform(ViewTransformData& viewTransformOut, const Size frameSize, const CalibrationData& calibrationData, const vector<Point2f>& sourcePoints, const vector<Point2f>& destinationPoints);
+void CalculateViewTransform(ViewTransformData& viewTransformOut, const Size frameSize, const Rect viewRect, const CalibrationData& calibrationData, const vector<Point2f>& sourcePoints, const vector<Point2f>& destinationPoints);
+// View transform of a frame scaled down to processingSize, with the lane geometry of each resolution and the lane projected back onto frameSize
+// filterInSkyView limits the sky view to the geometry's skyViewRect
+void CalculateProcessingViewTransform(ViewTransformData& viewTransformOut, const Size frameSize, const Size processingSize, bool filterInSkyView, const CalibrationData& calibrationData);
+void ViewTransformFrame(const Mat& frame, Mat& out, const ViewTransformData& viewTransform, int interpolation = INTER_LINEAR);